@@ -0,0 +1,166 @@
+//
+// File: PythonAssets.cpp
+// Desc: Definitions for PythonAssets class
+//
+
+#include "apu_python.h"
+
+PythonAssets& PythonAssets::getInstance()
+{
+    static PythonAssets assets;
+    return assets;
+}
+
+std::shared_ptr<PythonAssets::Asset> PythonAssets::open(const File& file)
+{
+    const String path = file.getFullPathName();
+
+    std::lock_guard lock(m_mutex);
+
+    // a changed file gets a new mapping, arrays still viewing the old one keep it alive
+    auto& cached = m_cache[path];
+    if (auto asset = cached.lock())
+        if (asset->modified == file.getLastModificationTime())
+            return asset;
+
+    auto asset = std::make_shared<Asset>(file);
+    if (asset->mapping.getData() == nullptr)
+        return nullptr;
+
+    cached = asset;
+
+    // forget files nobody refers to anymore
+    for (auto it = m_cache.begin(); it != m_cache.end();)
+        it = it->second.expired() ? m_cache.erase(it) : std::next(it);
+
+    return asset;
+}
+
+void PythonAssets::beginScript(const void* owner)
+{
+    std::lock_guard lock(m_mutex);
+    auto& pins = m_pins[owner];
+    pins.previous.insert(pins.previous.end(), pins.current.begin(), pins.current.end());
+    pins.current.clear();
+}
+
+void PythonAssets::endScript(const void* owner)
+{
+    std::vector<std::shared_ptr<Asset>> previous;
+    {
+        std::lock_guard lock(m_mutex);
+        previous.swap(m_pins[owner].previous);
+    }
+    // unmapped (if unused) outside the lock
+}
+
+void PythonAssets::pin(const void* owner, const std::shared_ptr<Asset>& asset)
+{
+    std::lock_guard lock(m_mutex);
+    auto& current = m_pins[owner].current;
+    if (std::find(current.begin(), current.end(), asset) == current.end())
+        current.push_back(asset);
+}
+
+void PythonAssets::release(const void* owner)
+{
+    Pins pins;
+    {
+        std::lock_guard lock(m_mutex);
+        auto found = m_pins.find(owner);
+        if (found == m_pins.end())
+            return;
+        pins = std::move(found->second);
+        m_pins.erase(found);
+    }
+    // unmapped (if unused) outside the lock
+}
+
+PythonAssets::Stats PythonAssets::getStats()
+{
+    std::lock_guard lock(m_mutex);
+    Stats stats;
+    for (auto& entry : m_cache) {
+        if (auto asset = entry.second.lock()) {
+            ++stats.mapped;
+            stats.bytes += (int64)asset->mapping.getSize();
+        }
+    }
+    return stats;
+}
+
+void PythonAssets::bind(py::module_& module)
+{
+    module.def(
+        "asset",
+        [](const std::string& path, py::object dtype, size_t offset) {
+            // relative paths are found next to the calling script
+            auto executor = PythonExecutor::getCurrent();
+            File file = File::getCurrentWorkingDirectory();
+            if (executor != nullptr)
+                file = file.getChildFile(String(executor->getScriptDirectory()));
+            file = file.getChildFile(String(path));
+            if (!file.existsAsFile())
+                throw py::value_error("asset not found: " + file.getFullPathName().toStdString());
+
+            auto asset = getInstance().open(file);
+            if (!asset)
+                throw py::value_error("asset can't be mapped: " + file.getFullPathName().toStdString());
+            if (executor != nullptr)
+                getInstance().pin(executor, asset);
+
+            const auto data = static_cast<const char*>(asset->mapping.getData());
+            const auto size = asset->mapping.getSize();
+
+            // .npy files describe their own type and shape, anything else is a flat array of dtype (bytes by default), an
+            // explicit dtype reads a .npy file's data as a flat array of that type
+            py::dtype type = dtype.is_none() ? py::dtype::of<uint8>() : py::dtype::from_args(dtype);
+            std::vector<py::ssize_t> shape;
+            bool fortranOrder = false;
+            if (file.hasFileExtension("npy") && size >= 10 && memcmp(data, "\x93NUMPY", 6) == 0) {
+                const bool version1 = data[6] == 1;
+                const size_t headerLength = version1 ? (size_t)ByteOrder::littleEndianShort(data + 8) : (size_t)ByteOrder::littleEndianInt(data + 8);
+                const size_t headerOffset = version1 ? 10 : 12;
+                if (headerOffset + headerLength > size)
+                    throw py::value_error("invalid npy header: " + path);
+                if (dtype.is_none()) {
+                    py::dict header = py::module_::import("ast").attr("literal_eval")(std::string(data + headerOffset, headerLength));
+                    type = py::dtype::from_args(header["descr"]);
+                    fortranOrder = header["fortran_order"].cast<bool>();
+                    for (auto dimension : header["shape"])
+                        shape.push_back(dimension.cast<py::ssize_t>());
+                }
+                offset += headerOffset + headerLength;
+            }
+
+            // mapped bytes can't hold python objects (pickled .npy files, dtype=object)
+            if (type.attr("hasobject").cast<bool>())
+                throw py::value_error("asset dtype can't contain python objects: " + path);
+            if (type.itemsize() <= 0)
+                throw py::value_error("asset dtype has no size: " + path);
+
+            if (offset > size)
+                throw py::value_error("asset offset beyond the end of the file: " + path);
+            if (shape.empty())
+                shape.push_back((py::ssize_t)((size - offset) / (size_t)type.itemsize()));
+
+            // contiguous strides in the file's order
+            std::vector<py::ssize_t> strides(shape.size());
+            py::ssize_t stride = type.itemsize();
+            for (size_t i = 0; i < shape.size(); ++i) {
+                const size_t dimension = fortranOrder ? i : shape.size() - 1 - i;
+                strides[dimension] = stride;
+                stride *= shape[dimension];
+            }
+            if ((size_t)(stride) > size - offset)
+                throw py::value_error("asset is smaller than its shape: " + path);
+
+            // the array holds a reference to the mapping, so it stays valid after the cache or script lets go
+            py::capsule owner(new std::shared_ptr<Asset>(asset), [](void* pointer) { delete static_cast<std::shared_ptr<Asset>*>(pointer); });
+            py::array array(type, shape, strides, data + offset, owner);
+            array.attr("setflags")(py::arg("write") = false);
+            return array;
+        },
+        py::arg("path"), py::arg("dtype") = py::none(), py::arg("offset") = 0,
+        "read-only array view of a memory-mapped file, shared by all instances (.npy files keep their type and shape)");
+}
@@ -0,0 +1,76 @@
+//
+// File: PythonAssets.h
+// Desc: Declarations for PythonAssets class
+//
+
+#ifndef PYTHON_ASSETS_H
+#define PYTHON_ASSETS_H
+
+#include "apu_python.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+//
+// PythonAssets
+//
+// Process-wide cache of read-only files (wavetables, lookup tables, response curves) exposed to scripts as
+// apu.asset(path), a zero-copy numpy view of a memory-mapped file. Every instance asking for the same file shares
+// one mapping, which stays mapped while any array or script still refers to it. The assets a script used are kept
+// while it's being replaced, so a reloaded script finds them already mapped.
+//
+
+class PythonAssets
+{
+public:
+    struct Asset
+    {
+        Asset(const File& file) : mapping(file, MemoryMappedFile::readOnly), modified(file.getLastModificationTime()) {}
+
+        MemoryMappedFile mapping;
+        Time modified;
+    };
+
+    struct Stats
+    {
+        int mapped = 0;
+        int64 bytes = 0;
+    };
+
+    static PythonAssets& getInstance();
+
+    // map a file, or share an existing mapping of it if the file hasn't changed since, nullptr if it can't be mapped
+    std::shared_ptr<Asset> open(const File& file);
+
+    // bracket (re)loading an owner's script, assets the old script used stay pinned until the new one is loaded
+    void beginScript(const void* owner);
+    void endScript(const void* owner);
+    // keep an asset mapped for as long as the owner's current script
+    void pin(const void* owner, const std::shared_ptr<Asset>& asset);
+    // drop all of an owner's pins
+    void release(const void* owner);
+
+    Stats getStats();
+
+    // add asset() to the given module
+    static void bind(py::module_& module);
+
+private:
+    PythonAssets() {}
+
+    struct Pins
+    {
+        std::vector<std::shared_ptr<Asset>> current;
+        std::vector<std::shared_ptr<Asset>> previous;
+    };
+
+    std::mutex m_mutex;
+    std::map<String, std::weak_ptr<Asset>> m_cache;
+    std::map<const void*, Pins> m_pins;
+
+    JUCE_DECLARE_NON_COPYABLE(PythonAssets)
+};
+
+#endif /* PYTHON_ASSETS_H */
@@ -37,11 +37,16 @@ PYBIND11_EMBEDDED_MODULE(apu, module)
         "print",
         [](py::args args, py::kwargs kwargs) {
             try {
+                std::string line;
                 for (py::size_t i = 0; i < args.size(); ++i) {
-                    std::string str = py::str(args[i]);
-                    printf(i == 0 ? "%s" : " %s", str.c_str());
+                    line += i == 0 ? "" : " ";
+                    line += std::string(py::str(args[i]));
                 }
-                printf("\n");
+                // never block on console output, the line goes to the calling script's log
+                if (auto executor = PythonExecutor::getCurrent())
+                    executor->getLog().write(PythonLog::LevelOutput, line.data(), line.size(), true);
+                else
+                    printf("%s\n", line.c_str());
             }
             catch (...) {
             }
@@ -51,45 +56,496 @@ PYBIND11_EMBEDDED_MODULE(apu, module)
     module.def("noteEvent", noteEvent);
     module.def("programChangeEvent", programChangeEvent);
     module.attr("__dict__")["globals"] = py::dict();
+    // offset of RPN keys in processMidiParameters input
+    module.attr("RPN") = 0x4000;
+    PythonSharedState::bind(module);
+    PythonAssets::bind(module);
 }
 
-PythonAudioProcessor::PythonAudioProcessor() : m_pythonEditor(*this, this, ""), m_vts(*this, &m_undoManager)
+// default callback budget, as a fraction of the block duration
+static const double defaultBudget = 1.0;
+
+// default rate of processControl calls, in Hz
+static const double defaultControlRate = 200.0;
+
+// read an optional non-negative number from the script, falling back to the default if it's missing or invalid
+static double getSetting(const py::dict& dict, const char* name, double fallback, PythonLog& log)
 {
-    m_vts.state = ValueTree(Identifier(JucePlugin_Name));
+    if (!dict.contains(name))
+        return fallback;
+
+    const py::object value = dict[name];
+    if ((py::isinstance<py::int_>(value) || py::isinstance<py::float_>(value)) && !py::isinstance<py::bool_>(value)) {
+        const double number = value.cast<double>();
+        if (std::isfinite(number) && number >= 0.0)
+            return number;
+    }
+
+    log.writeLine(PythonLog::LevelError, (std::string("'") + name + "' must be a non-negative number, using the default").c_str());
+    return fallback;
 }
 
-PythonAudioProcessor::~PythonAudioProcessor() {}
+// number of consecutive overruns which disable the script
+static const int maxConsecutiveOverruns = 8;
 
-void PythonAudioProcessor::execute(const char* filename, const char* script)
+// maximum number of channels on any one bus
+static const int maxBusChannels = 8;
+
+// midi output storage reserved up front, enough for a dense block of short messages
+static const size_t midiReserveBytes = 8192;
+
+static AudioProcessor::BusesProperties getDefaultBuses()
+{
+    // main stereo in/out, plus an optional sidechain and auxiliary outputs (e.g. stems)
+    return AudioProcessor::BusesProperties()
+        .withInput("Input", AudioChannelSet::stereo(), true)
+        .withInput("Sidechain", AudioChannelSet::stereo(), false)
+        .withOutput("Output", AudioChannelSet::stereo(), true)
+        .withOutput("Aux 1", AudioChannelSet::stereo(), false)
+        .withOutput("Aux 2", AudioChannelSet::stereo(), false)
+        .withOutput("Aux 3", AudioChannelSet::stereo(), false);
+}
+
+// determine whether the buffer's channels are evenly spaced in memory, so they can be viewed as one 2D array
+template <typename SampleType>
+static bool getChannelStride(const AudioBuffer<SampleType>& buffer, ptrdiff_t& stride)
+{
+    auto channels = buffer.getArrayOfReadPointers();
+    stride = buffer.getNumSamples();
+    if (buffer.getNumChannels() < 2)
+        return true;
+
+    const auto bytes = reinterpret_cast<std::intptr_t>(channels[1]) - reinterpret_cast<std::intptr_t>(channels[0]);
+    if (bytes % (std::intptr_t)sizeof(SampleType) != 0 || bytes / (std::intptr_t)sizeof(SampleType) < buffer.getNumSamples())
+        return false;
+
+    for (auto i = 2; i < buffer.getNumChannels(); ++i)
+        if (reinterpret_cast<std::intptr_t>(channels[i]) - reinterpret_cast<std::intptr_t>(channels[i - 1]) != bytes)
+            return false;
+
+    stride = bytes / (std::intptr_t)sizeof(SampleType);
+    return true;
+}
+
+// create a [channel, sample] array referencing the given memory
+template <typename SampleType>
+static py::array createChannelArray(SampleType* data, int numChannels, int numSamples, ptrdiff_t stride)
+{
+    const std::vector<py::ssize_t> shape = { numChannels, numSamples };
+    const std::vector<py::ssize_t> strides = { (py::ssize_t)(stride * sizeof(SampleType)), (py::ssize_t)sizeof(SampleType) };
+    py::str dummy; // prevent pybind11 from copying (jackie chan wtf meme)
+    return py::array(py::dtype::of<SampleType>(), shape, strides, data, dummy);
+}
+
+// idle thread states kept ready for host threads which haven't called into the processor yet
+static const int reservedThreadStates = 4;
+
+// default parameter smoothing time, in seconds
+static const double defaultSmoothingSeconds = 0.02;
+
+// midi routing by status byte, channel messages for all 16 channels, sysex and the realtime transport messages
+const std::array<PythonAudioProcessor::MidiRoute, 256> PythonAudioProcessor::g_midiRoutes = [] {
+    std::array<MidiRoute, 256> routes;
+    routes.fill({ 0, NumMidiInputs });
+    for (auto channel = 0; channel < 16; ++channel) {
+        routes[0x80 | channel] = { HookProcessMidiNotes, MidiInputNoteOffs };
+        routes[0x90 | channel] = { HookProcessMidiNotes, MidiInputNoteOns };
+        routes[0xa0 | channel] = { HookProcessPolyPressure, MidiInputPolyPressures };
+        routes[0xb0 | channel] = { HookProcessMidiControls, MidiInputControls };
+        routes[0xc0 | channel] = { HookProcessProgramChanges, MidiInputProgramChanges };
+        routes[0xd0 | channel] = { HookProcessChannelPressure, MidiInputChannelPressures };
+        routes[0xe0 | channel] = { HookProcessPitchBend, MidiInputPitchBends };
+    }
+    routes[0xf0] = { HookProcessSysEx, MidiInputSysEx };
+    // clock, start, continue and stop
+    for (auto status : { 0xf8, 0xfa, 0xfb, 0xfc })
+        routes[status] = { HookProcessTransport, MidiInputTransport };
+    return routes;
+}();
+
+// empty a reused dict or list argument
+static void clearContainer(py::handle container)
+{
+    if (PyDict_Check(container.ptr()))
+        PyDict_Clear(container.ptr());
+    else if (PyList_Check(container.ptr()))
+        PyList_SetSlice(container.ptr(), 0, PY_SSIZE_T_MAX, nullptr);
+}
+
+// ints for every midi input key and value (NRPN/RPN keys up to 0x7fff, 14-bit values up to 0x3fff), Python itself
+// only caches -5..256, created by the first script load and kept for the life of the interpreter
+static constexpr int numCachedInts = 0x8000;
+static PyObject* g_ints[numCachedInts] = {};
+
+static void createInts()
+{
+    if (g_ints[0] == nullptr)
+        for (auto i = 0; i < numCachedInts; ++i)
+            g_ints[i] = PyLong_FromLong(i);
+}
+
+static void setItem(py::handle dict, int key, int value)
+{
+    if (isPositiveAndBelow(key, numCachedInts) && isPositiveAndBelow(value, numCachedInts))
+        PyDict_SetItem(dict.ptr(), g_ints[key], g_ints[value]);
+    else
+        PyDict_SetItem(dict.ptr(), py::int_(key).ptr(), py::int_(value).ptr());
+}
+
+PythonAudioProcessor::ScriptParameter::ScriptParameter(int index)
+  : AudioParameterFloat("param" + String(index + 1), "Param " + String(index + 1), 0.0f, 1.0f, 0.0f)
+{
+}
+
+void PythonAudioProcessor::ScriptParameter::setScriptName(const String& name, float minimum, float maximum)
+{
+    const SpinLock::ScopedLockType lock(m_lock);
+    m_scriptName = name;
+    m_minimum = minimum;
+    m_maximum = maximum;
+}
+
+String PythonAudioProcessor::ScriptParameter::getScriptName() const
+{
+    const SpinLock::ScopedLockType lock(m_lock);
+    return m_scriptName;
+}
+
+String PythonAudioProcessor::ScriptParameter::getName(int maximumStringLength) const
+{
+    // unclaimed parameters keep their generic name
+    const String name = getScriptName();
+    return (name.isEmpty() ? AudioParameterFloat::getName(maximumStringLength) : name).substring(0, maximumStringLength);
+}
+
+String PythonAudioProcessor::ScriptParameter::getText(float normalisedValue, int maximumStringLength) const
+{
+    const SpinLock::ScopedLockType lock(m_lock);
+    if (m_scriptName.isEmpty())
+        return AudioParameterFloat::getText(normalisedValue, maximumStringLength);
+    return String(m_minimum + normalisedValue * (m_maximum - m_minimum), 3).substring(0, maximumStringLength);
+}
+
+float PythonAudioProcessor::ScriptParameter::getValueForText(const String& text) const
+{
+    const SpinLock::ScopedLockType lock(m_lock);
+    if (m_scriptName.isEmpty())
+        return AudioParameterFloat::getValueForText(text);
+    if (m_maximum == m_minimum)
+        return 0.0f;
+    return jlimit(0.0f, 1.0f, (text.getFloatValue() - m_minimum) / (m_maximum - m_minimum));
+}
+
+AudioProcessorValueTreeState::ParameterLayout PythonAudioProcessor::createParameterLayout()
+{
+    AudioProcessorValueTreeState::ParameterLayout layout;
+    for (auto i = 0; i < maxParameters; ++i)
+        layout.add(std::make_unique<ScriptParameter>(i));
+    return layout;
+}
+
+PythonAudioProcessor::PythonAudioProcessor()
+  : AudioProcessor(getDefaultBuses()),
+    m_pythonEditor(*this, this, ""),
+    m_vts(*this, &m_undoManager, Identifier(JucePlugin_Name), createParameterLayout())
 {
-    PythonExecutor::execute(filename, script);
 
+    for (auto i = 0; i < maxParameters; ++i) {
+        const String id = "param" + String(i + 1);
+        m_parameters[(size_t)i].parameter = dynamic_cast<ScriptParameter*>(m_vts.getParameter(id));
+        m_parameters[(size_t)i].value = m_vts.getRawParameterValue(id);
+    }
+}
+
+PythonAudioProcessor::~PythonAudioProcessor()
+{
+    // a worker may still hold an entry for the last block's job
+    if (auto* scheduler = PythonScheduler::getInstance())
+        scheduler->retire(m_job);
+
+    // release the argument objects while holding the interpreter
     PythonExecutor::lock();
+    m_arguments = Arguments();
+    m_stages.clear();
+    PythonExecutor::unlock();
+}
 
-    // initialize output tuples
-    try {
-        m_outputs.clear();
+void PythonAudioProcessor::execute(const char* filename, const char* script)
+{
+    // assets the previous script mapped stay mapped until the new script and its pipeline are loaded
+    PythonAssets::getInstance().beginScript(static_cast<PythonExecutor*>(this));
 
-        // request midi outputs from the script
-        py::dict dict = PythonExecutor::getModule().attr("__dict__");
-        if (dict.contains("getMidiOutputs")) {
-            py::list midiOutputs = dict["getMidiOutputs"]();
-            for (auto& midiOutput : midiOutputs) {
-                py::tuple tuple = midiOutput.cast<py::tuple>();
-                std::string prefix = tuple[0].cast<std::string>();
-                std::string suffix = tuple[1].cast<std::string>();
-                m_outputs.emplace_back(std::make_tuple(prefix, suffix));
-            }
+    // the script and everything derived from it are built while the previous script keeps processing, and only
+    // swapped in under the lock (see PythonExecutor::loadScript)
+    LoadedScript loaded;
+    PythonExecutor::lockLoad();
+    bool succeeded = PythonExecutor::loadScript(filename, script);
+    if (succeeded) {
+        try {
+            loadScriptState(filename, loaded);
+        }
+        catch (const std::exception& e) {
+            getLog().writeLine(PythonLog::LevelError, e.what());
+            succeeded = false;
+        }
+        catch (...) {
+            succeeded = false;
         }
+        if (!succeeded)
+            getLog().writeLine(PythonLog::LevelError, "script failed, the previous script (if any) stays active");
+    }
+    PythonExecutor::unlockLoad();
 
-        // load globals dictionary
-        py::exec("def setGlobals(data):\n    import json\n    apu.globals.update(json.loads(data), **apu.globals)", dict, dict);
-        dict["setGlobals"](m_globals == "" ? "{}" : m_globals);
+    if (succeeded) {
+        PythonExecutor::lock();
+        PythonExecutor::commitScript();
+        commitScriptState(loaded);
+        // the context may have changed (prepareToPlay) while the script was loading
+        rebindContext();
+        PythonExecutor::unlock();
     }
-    catch (...) {
+
+    // the declarations are plain C++, kept for the host below once the Python objects are gone
+    const auto parameters = std::move(loaded.parameters);
+    const auto defaults = std::move(loaded.defaults);
+
+    // release whichever script isn't running, without holding off the running one
+    PythonExecutor::lockLoad();
+    PythonExecutor::discardScript();
+    loaded = LoadedScript();
+    PythonExecutor::unlockLoad();
+
+    // a failing script leaves the previous one running, along with its assets
+    if (!succeeded)
+        return;
+
+    PythonAssets::getInstance().endScript(static_cast<PythonExecutor*>(this));
+
+    // let the host know about the new parameter names and defaults
+    for (auto i = 0; i < maxParameters; ++i) {
+        auto& parameter = m_parameters[(size_t)i];
+        if (i < (int)parameters.size()) {
+            const auto& declaration = parameters[(size_t)i];
+            parameter.parameter->setScriptName(declaration.name, declaration.minimum, declaration.maximum);
+        }
+        else {
+            parameter.parameter->setScriptName(String());
+        }
     }
+    for (auto& entry : defaults)
+        entry.first->setValueNotifyingHost(entry.second);
+    updateHostDisplay();
+}
 
-    PythonExecutor::unlock();
+void PythonAudioProcessor::loadScriptState(const char* filename, LoadedScript& loaded)
+{
+    py::dict dict = PythonExecutor::getLoadedModule().attr("__dict__");
+
+    // look up the processing functions the script defines once, rather than per block
+    loaded.hooks = initArguments(dict, loaded.arguments);
+
+    // optional callback budget, as a fraction of the block duration
+    loaded.budget = getSetting(dict, "budget", defaultBudget, getLog());
+
+    // optional control rate, in Hz
+    loaded.controlRate = getSetting(dict, "control_rate", defaultControlRate, getLog());
+
+    // request midi outputs from the script
+    loaded.outputs = getMidiOutputs(dict);
+    loaded.controlValues.assign(loaded.outputs.size(), -1);
+
+    // claim parameters from the pool in declaration order, parameters claimed by a different script start at their
+    // declared default
+    if (dict.contains("getParameters")) {
+        for (auto& entry : dict["getParameters"]()) {
+            if ((int)loaded.parameters.size() == maxParameters)
+                break;
+            const py::tuple tuple = entry.cast<py::tuple>();
+            ParameterDeclaration declaration;
+            declaration.name = tuple[0].cast<std::string>();
+            declaration.minimum = tuple.size() > 1 ? tuple[1].cast<float>() : 0.0f;
+            declaration.maximum = tuple.size() > 2 ? tuple[2].cast<float>() : 1.0f;
+            const float value = tuple.size() > 3 ? tuple[3].cast<float>() : declaration.minimum;
+            declaration.smoothingSeconds = tuple.size() > 4 ? tuple[4].cast<double>() : defaultSmoothingSeconds;
+
+            auto parameter = m_parameters[loaded.parameters.size()].parameter;
+            loaded.arguments.parameterKeys[loaded.parameters.size()] = py::str(declaration.name.toStdString());
+            if (declaration.name != parameter->getScriptName() && declaration.maximum != declaration.minimum)
+                loaded.defaults.emplace_back(parameter, jlimit(0.0f, 1.0f, (value - declaration.minimum) / (declaration.maximum - declaration.minimum)));
+            loaded.parameters.push_back(declaration);
+        }
+    }
+
+    loaded.arguments.parameters = py::dict();
+    dict["params"] = loaded.arguments.parameters;
+
+    // load the pipeline stages following this script
+    loaded.stageHooks = loadPipeline(dict, filename, loaded.stages);
+
+    // load globals dictionary
+    py::exec("def setGlobals(data):\n    import json\n    apu.globals.update(json.loads(data), **apu.globals)", dict, dict);
+    dict["setGlobals"](m_globals == "" ? "{}" : m_globals);
+}
+
+void PythonAudioProcessor::commitScriptState(LoadedScript& loaded)
+{
+    // the replaced state is left in loaded, to be released outside the lock
+    std::swap(m_arguments, loaded.arguments);
+    std::swap(m_outputs, loaded.outputs);
+    std::swap(m_controlValues, loaded.controlValues);
+    std::swap(m_stages, loaded.stages);
+    m_hooks = loaded.hooks;
+    m_stageHooks = loaded.stageHooks;
+
+    // the new script's outputs start without pickup values or a selected parameter, its inputs start unpaired
+    // (fresh Arguments and stages)
+    m_outputState.reset();
+
+    m_budget = loaded.budget;
+    m_consecutiveOverruns = 0;
+    m_controlRate = loaded.controlRate;
+    m_controlReset = true;
+
+    for (size_t i = 0; i < loaded.parameters.size(); ++i) {
+        auto& parameter = m_parameters[i];
+        parameter.minimum = loaded.parameters[i].minimum;
+        parameter.maximum = loaded.parameters[i].maximum;
+        parameter.smoothingSeconds = loaded.parameters[i].smoothingSeconds;
+        parameter.snap = true;
+    }
+    m_numParameters = (int)loaded.parameters.size();
+}
+
+uint32_t PythonAudioProcessor::initArguments(const py::dict& dict, Arguments& args)
+{
+    auto getHook = [&dict](const char* name) { return dict.contains(name) ? py::object(dict[name]) : py::object(); };
+    args.processAudio = getHook("processAudio");
+    args.processMidiControls = getHook("processMidiControls");
+    args.processMidiNotes = getHook("processMidiNotes");
+    args.processProgramChanges = getHook("processProgramChanges");
+    args.processPitchBend = getHook("processPitchBend");
+    args.processChannelPressure = getHook("processChannelPressure");
+    args.processPolyPressure = getHook("processPolyPressure");
+    args.processTransport = getHook("processTransport");
+    args.processSysEx = getHook("processSysEx");
+    args.processControl = getHook("processControl");
+    args.processMidiParameters = getHook("processMidiParameters");
+    createInts();
+
+    // optional 14-bit input controllers
+    args.midiState.reset();
+    args.midiState.controllers14 = 0;
+    if (dict.contains("cc14_inputs"))
+        for (auto controller : dict["cc14_inputs"])
+            if (isPositiveAndBelow(controller.cast<int>(), 32))
+                args.midiState.controllers14 |= 1u << controller.cast<int>();
+
+    for (auto& input : args.midiInputs)
+        input = py::dict();
+    args.midiInputs[MidiInputSysEx] = py::list();
+    args.midiOutputs = py::dict();
+    args.controlOutputs = py::dict();
+
+    uint32_t hooks = 0;
+    hooks |= args.processAudio ? HookProcessAudio : 0;
+    hooks |= args.processMidiControls ? HookProcessMidiControls : 0;
+    hooks |= args.processMidiNotes ? HookProcessMidiNotes : 0;
+    hooks |= args.processProgramChanges ? HookProcessProgramChanges : 0;
+    hooks |= args.processPitchBend ? HookProcessPitchBend : 0;
+    hooks |= args.processChannelPressure ? HookProcessChannelPressure : 0;
+    hooks |= args.processPolyPressure ? HookProcessPolyPressure : 0;
+    hooks |= args.processTransport ? HookProcessTransport : 0;
+    hooks |= args.processSysEx ? HookProcessSysEx : 0;
+    hooks |= args.processControl ? HookProcessControl : 0;
+    hooks |= args.processMidiParameters ? HookProcessMidiParameters : 0;
+    return hooks;
+}
+
+std::vector<PythonAudioProcessor::MidiOutput> PythonAudioProcessor::getMidiOutputs(const py::dict& dict)
+{
+    std::vector<MidiOutput> outputs;
+    if (!dict.contains("getMidiOutputs"))
+        return outputs;
+
+    py::list midiOutputs = dict["getMidiOutputs"]();
+    for (auto& midiOutput : midiOutputs) {
+        py::tuple tuple = midiOutput.cast<py::tuple>();
+
+        // 14-bit outputs are declared by type, channel (1-16) and number
+        if (py::isinstance<py::str>(tuple[0])) {
+            const std::string type = tuple[0].cast<std::string>();
+            if (type != "cc14" && type != "nrpn" && type != "rpn")
+                throw py::value_error("unknown midi output type '" + type + "'");
+            MidiOutput output;
+            output.type = type == "cc14" ? MidiOutput::TypeController14 : type == "nrpn" ? MidiOutput::TypeNrpn : MidiOutput::TypeRpn;
+            const int channel = tuple[1].cast<int>();
+            const int number = tuple[2].cast<int>();
+            const int maxNumber = output.type == MidiOutput::TypeController14 ? 31 : 0x3fff;
+            if (channel < 1 || channel > 16)
+                throw py::value_error("midi output channel " + std::to_string(channel) + " is not in 1-16");
+            if (number < 0 || number > maxNumber)
+                throw py::value_error(type + " number " + std::to_string(number) + " is not in 0-" + std::to_string(maxNumber));
+            output.channel = channel - 1;
+            output.number = number;
+            outputs.push_back(std::move(output));
+            continue;
+        }
+
+        std::string prefix = tuple[0].cast<std::string>();
+        std::string suffix = tuple[1].cast<std::string>();
+        // pre-build the output's message, leaving a slot for the value
+        MidiOutput output;
+        output.message.assign(prefix.begin(), prefix.end());
+        output.valueIndex = output.message.size();
+        output.message.push_back(0);
+        output.message.insert(output.message.end(), suffix.begin(), suffix.end());
+        outputs.push_back(std::move(output));
+    }
+    return outputs;
+}
+
+uint32_t PythonAudioProcessor::loadPipeline(const py::dict& dict, const char* filename, std::vector<Stage>& stages)
+{
+    if (!dict.contains("pipeline"))
+        return 0;
+
+    // stages are found relative to the main script, and get the same context (see prepareContext) and params
+    const File directory = File::getCurrentWorkingDirectory().getChildFile(filename).getParentDirectory();
+
+    for (auto entry : dict["pipeline"]) {
+        Stage stage;
+        stage.filename = entry.cast<std::string>();
+        const File file = directory.getChildFile(String(stage.filename));
+        if (!file.existsAsFile()) {
+            getLog().writeLine(PythonLog::LevelError, ("pipeline stage not found: " + file.getFullPathName()).toRawUTF8());
+            continue;
+        }
+
+        // stage files are watched like helper modules, so editing one re-executes the main script
+        PythonExecutor::addDependency(file.getFullPathName().toStdString());
+
+        try {
+            stage.module = PythonExecutor::createContext();
+            py::dict scope = stage.module.attr("__dict__");
+            scope["__file__"] = file.getFullPathName().toStdString();
+            scope["params"] = dict["params"];
+
+            py::exec(file.loadFileAsString().toStdString(), scope, scope);
+
+            // control rate processing is only scheduled for the main script
+            stage.hooks = initArguments(scope, stage.arguments) & ~(uint32_t)HookProcessControl;
+            stage.outputs = getMidiOutputs(scope);
+            stages.push_back(std::move(stage));
+        }
+        catch (const std::exception& e) {
+            getLog().writeLine(PythonLog::LevelError, (stage.filename + ": " + e.what()).c_str());
+        }
+    }
+
+    uint32_t stageHooks = 0;
+    for (auto& stage : stages)
+        stageHooks |= stage.hooks;
+    return stageHooks;
 }
 
 void PythonAudioProcessor::filenameComponentChanged(FilenameComponent* filenameComponent)
@@ -102,141 +558,854 @@ void PythonAudioProcessor::filenameComponentChanged(FilenameComponent* filenameC
 
 void PythonAudioProcessor::prepareToPlay(double sampleRate, int samplesPerBlock)
 {
-    // bind current samplerate so its accessible to processing functions
+    // reserve scratch memory for gathering channels, enough for any layout the buses can be switched to
+    const auto numChannels = std::max(getTotalNumInputChannels(), getTotalNumOutputChannels());
+    const auto maxChannels = std::max(numChannels, std::max(getBusCount(true), getBusCount(false)) * maxBusChannels);
+    std::get<std::vector<float>>(m_scratch).resize((size_t)(maxChannels * samplesPerBlock));
+    std::get<std::vector<double>>(m_scratch).resize((size_t)(maxChannels * samplesPerBlock));
+
+    // reserve midi output storage
+    m_processedMidi.ensureSize(midiReserveBytes);
+    for (auto& events : m_stageEvents)
+        events.reserve(midiReserveBytes);
+
+    // restart the control rate schedule
+    m_controlReset = true;
+
     PythonExecutor::lock();
-    PythonExecutor::bind("sample_rate", py::int_((int)getSampleRate()));
+
+    // parameter smoothing buffers, any views of the previous buffers are dropped
+    m_parameterBuffers.allocate((size_t)(maxParameters * samplesPerBlock), true);
+    m_ramp.allocate((size_t)samplesPerBlock, false);
+    for (auto i = 0; i < samplesPerBlock; ++i)
+        m_ramp[i] = (float)(i + 1);
+    m_parameterBufferSamples = samplesPerBlock;
+    for (auto i = 0; i < maxParameters; ++i) {
+        m_arguments.parameterViews[(size_t)i] = py::object();
+        m_arguments.parameterViewSamples[(size_t)i] = 0;
+    }
+
+    // the first block on a new host thread shouldn't have to create its thread state
+    PythonThreadStatePool::getInstance().reserve(PyThreadState_Get()->interp, reservedThreadStates);
+
+    rebindContext();
     PythonExecutor::unlock();
+
+    // optionally trace processed blocks
+    m_trace.startFromEnvironment(getName(), sampleRate, samplesPerBlock, numChannels);
 }
 
-void PythonAudioProcessor::processBlock(AudioBuffer<float>& buffer, MidiBuffer& midiMessages)
+void PythonAudioProcessor::releaseResources()
 {
-    ScopedNoDenormals noDenormals;
+    stopTrace();
 
+    // free the states left behind by host threads which have exited
     PythonExecutor::lock();
+    PythonThreadStatePool::getInstance().trim(reservedThreadStates);
+    PythonExecutor::unlock();
+}
 
-    auto totalNumInputChanenls = getTotalNumInputChannels();
-    auto totalNumOutputChannels = getTotalNumOutputChannels();
+void PythonAudioProcessor::stopTrace()
+{
+    if (!m_trace.isRecording())
+        return;
+
+    m_trace.stop();
+    if (m_trace.hasFailed())
+        getLog().writeLine(PythonLog::LevelError, ("trace: writing failed, " + String(m_trace.getDroppedBlocks()) + " blocks dropped").toRawUTF8());
+    else if (m_trace.getDroppedBlocks() > 0)
+        getLog().writeLine(PythonLog::LevelOutput, ("trace: " + String(m_trace.getDroppedBlocks()) + " blocks dropped").toRawUTF8());
+}
+
+bool PythonAudioProcessor::startTrace(const File& file, bool recordAudio)
+{
+    const auto numChannels = std::max(getTotalNumInputChannels(), getTotalNumOutputChannels());
+    return m_trace.start(file, getName(), getSampleRate(), getBlockSize(), numChannels, recordAudio);
+}
+
+bool PythonAudioProcessor::isBusesLayoutSupported(const BusesLayout& layouts) const
+{
+    // the main output is required, all other buses may be disabled or use any layout up to the channel limit
+    if (layouts.getMainOutputChannelSet().isDisabled())
+        return false;
+
+    for (auto& bus : layouts.inputBuses)
+        if (bus.size() > maxBusChannels)
+            return false;
+
+    for (auto& bus : layouts.outputBuses)
+        if (bus.size() > maxBusChannels)
+            return false;
+
+    return true;
+}
 
+void PythonAudioProcessor::prepareContext(py::dict scope)
+{
+    // bind current samplerate and bus layout so they're accessible to processing functions
     try {
-        MidiBuffer processedMidi;
+        scope["sample_rate"] = py::int_((int)getSampleRate());
+        scope["buses"] = getBusInfo();
+        scope["offline"] = py::bool_(m_offline.load());
+        scope["transport"] = createTransportArray();
+    }
+    catch (...) {
+    }
+}
 
-        py::list audioInputs;
-        py::list audioOutputs;
+void PythonAudioProcessor::rebindContext()
+{
+    prepareContext(PythonExecutor::getModule().attr("__dict__"));
+    for (auto& stage : m_stages)
+        prepareContext(stage.module.attr("__dict__"));
+}
 
-        py::dict midiControlInputs;
-        py::dict midiNoteOnInputs;
-        py::dict midiNoteOffInputs;
-        py::dict midiProgramChangeInputs;
-        py::dict midiOutputs;
+py::array PythonAudioProcessor::createTransportArray()
+{
+    static_assert(sizeof(bool) == 1, "transport flags are exposed as numpy bools");
 
-        // allow script to process any audio and/or midi messages
-        const py::dict dict = PythonExecutor::getModule().attr("__dict__");
+    // field name, numpy format and offset of each member
+    const std::tuple<const char*, const char*, size_t> fields[] = {
+        { "bpm", "f8", offsetof(Transport, bpm) },
+        { "ppq", "f8", offsetof(Transport, ppqPosition) },
+        { "bar_start", "f8", offsetof(Transport, ppqPositionOfLastBarStart) },
+        { "loop_start", "f8", offsetof(Transport, ppqLoopStart) },
+        { "loop_end", "f8", offsetof(Transport, ppqLoopEnd) },
+        { "samples", "i8", offsetof(Transport, timeInSamples) },
+        { "time_sig_numerator", "i4", offsetof(Transport, timeSigNumerator) },
+        { "time_sig_denominator", "i4", offsetof(Transport, timeSigDenominator) },
+        { "playing", "?", offsetof(Transport, isPlaying) },
+        { "recording", "?", offsetof(Transport, isRecording) },
+        { "looping", "?", offsetof(Transport, isLooping) },
+        { "valid", "?", offsetof(Transport, isValid) },
+    };
 
-        // check for existance of processing funtions
-        const bool processAudio = dict.contains("processAudio");
-        const bool processMidiControls = dict.contains("processMidiControls");
-        const bool processMidiNotes = dict.contains("processMidiNotes");
-        const bool processProgramChanges = dict.contains("processProgramChanges");
+    py::list names, formats, offsets;
+    for (const auto& field : fields) {
+        names.append(std::get<0>(field));
+        formats.append(std::get<1>(field));
+        offsets.append(std::get<2>(field));
+    }
+
+    // a read-only 0-d view, e.g. transport['bpm']
+    py::str dummy; // prevent pybind11 from copying
+    py::array array(py::dtype(names, formats, offsets, sizeof(Transport)), std::vector<py::ssize_t>(), std::vector<py::ssize_t>(), &m_transport, dummy);
+    array.attr("setflags")(py::arg("write") = false);
+    return array;
+}
 
-        // prepare audio input
-        for (auto i = 0; i < totalNumInputChanenls; ++i) {
-            py::str dummy; // prevent pybind11 from copying (jackie chan wtf meme)
-            audioInputs.append(py::array(buffer.getNumSamples(), buffer.getReadPointer(i), dummy));
+void PythonAudioProcessor::updateTransport()
+{
+    AudioPlayHead::CurrentPositionInfo position;
+    auto playHead = getPlayHead();
+    m_hostTransport.isValid = playHead != nullptr && playHead->getCurrentPosition(position);
+    if (!m_hostTransport.isValid) {
+        m_hostTransport.isPlaying = false;
+        m_hostTransport.isRecording = false;
+        return;
+    }
+
+    m_hostTransport.bpm = position.bpm;
+    m_hostTransport.ppqPosition = position.ppqPosition;
+    m_hostTransport.ppqPositionOfLastBarStart = position.ppqPositionOfLastBarStart;
+    m_hostTransport.ppqLoopStart = position.ppqLoopStart;
+    m_hostTransport.ppqLoopEnd = position.ppqLoopEnd;
+    m_hostTransport.timeInSamples = position.timeInSamples;
+    m_hostTransport.timeSigNumerator = position.timeSigNumerator;
+    m_hostTransport.timeSigDenominator = position.timeSigDenominator;
+    m_hostTransport.isPlaying = position.isPlaying;
+    m_hostTransport.isRecording = position.isRecording;
+    m_hostTransport.isLooping = position.isLooping;
+}
+
+py::dict PythonAudioProcessor::getBusInfo()
+{
+    py::dict info;
+
+    for (const bool isInput : { true, false }) {
+        py::list buses;
+        int channel = 0;
+        for (auto i = 0; i < getBusCount(isInput); ++i) {
+            const auto bus = getBus(isInput, i);
+            const auto count = bus->getNumberOfChannels();
+            buses.append(py::make_tuple(bus->getName().toStdString(), channel, count));
+            channel += count;
         }
+        info[isInput ? "inputs" : "outputs"] = buses;
+    }
 
-        // prepare audio output
-        if (processAudio) {
-            for (auto i = 0; i < totalNumOutputChannels; ++i) {
-                py::str dummy; // prevent pybind11 from copying (jackie chan wtf meme)
-                audioOutputs.append(py::array(buffer.getNumSamples(), buffer.getWritePointer(i), dummy));
+    return info;
+}
+
+bool PythonAudioProcessor::isIdle(const MidiBuffer& midiMessages, uint32_t hooks)
+{
+    if (hooks & HookProcessAudio)
+        return false;
+
+    // any message which would be handed to the script makes the block busy
+    for (const auto metaData : midiMessages) {
+        if (hooks & g_midiRoutes[metaData.data[0]].hook)
+            return false;
+        if ((hooks & HookProcessMidiParameters) && (metaData.data[0] & 0xf0) == 0xb0)
+            return false;
+    }
+
+    return true;
+}
+
+void PythonAudioProcessor::MidiEvents::addEvent(const void* data, int numBytes, int samplePosition)
+{
+    const auto bytes = static_cast<const juce::uint8*>(data);
+    m_events.push_back({ m_data.size(), numBytes, samplePosition });
+    m_data.insert(m_data.end(), bytes, bytes + numBytes);
+    m_lastEventTime = std::max(m_lastEventTime, samplePosition);
+}
+
+MidiMessageMetadata PythonAudioProcessor::MidiEvents::Iterator::operator*() const
+{
+    const auto& event = events->m_events[index];
+    return MidiMessageMetadata(events->m_data.data() + event.offset, event.numBytes, event.samplePosition);
+}
+
+template <typename Events, typename Sink>
+void PythonAudioProcessor::dispatchMidi(const Events& events, Arguments& args, uint32_t hooks, Sink& passThrough)
+{
+    // reuse the argument containers, and fill them with cached ints (see setItem) so dispatch is allocation free
+    auto& inputs = args.midiInputs;
+    if (hooks != 0)
+        for (auto& input : inputs)
+            clearContainer(input);
+
+    // dispatch midi input by status byte, reading the events in place rather than copying them into MidiMessages
+    int transportCounts[8] = {};
+    for (const auto metaData : events) {
+        const juce::uint8* messageData = metaData.data;
+        const auto& route = g_midiRoutes[messageData[0]];
+        const int channel = (messageData[0] & 0x0f) + 1;
+        const int data1 = metaData.numBytes > 1 ? messageData[1] : 0;
+        const int data2 = metaData.numBytes > 2 ? messageData[2] : 0;
+
+        // controllers which are part of a 14-bit value or NRPN/RPN sequence the script asked for
+        if (route.input == MidiInputControls && pairController(args, hooks, channel - 1, data1, data2))
+            continue;
+
+        // pass through all MIDI events the script doesn't handle
+        if ((hooks & route.hook) == 0) {
+            passThrough.addEvent(messageData, metaData.numBytes, metaData.samplePosition);
+            continue;
+        }
+
+        switch (route.input) {
+            case MidiInputNoteOns:
+                // a note on with zero velocity is a note off
+                setItem(inputs[data2 != 0 ? MidiInputNoteOns : MidiInputNoteOffs], data1, data2);
+                break;
+            case MidiInputPitchBends:
+                setItem(inputs[route.input], channel, data1 | (data2 << 7));
+                break;
+            case MidiInputChannelPressures:
+                setItem(inputs[route.input], channel, data1);
+                break;
+            case MidiInputTransport:
+                ++transportCounts[messageData[0] - 0xf8];
+                break;
+            case MidiInputSysEx:
+                py::reinterpret_borrow<py::list>(inputs[route.input]).append(py::bytes((const char*)messageData, (size_t)metaData.numBytes));
+                break;
+            default:
+                setItem(inputs[route.input], data1, data2);
+                break;
+        }
+    }
+    // clock ticks are counted rather than handed over one by one
+    for (auto i = 0; i < 8; ++i)
+        if (transportCounts[i] > 0)
+            setItem(inputs[MidiInputTransport], 0xf8 + i, transportCounts[i]);
+
+    if (args.midiState.numPending > 0)
+        flushPairs(args);
+}
+
+void PythonAudioProcessor::MidiInputState::reset()
+{
+    for (auto& channel : controlMsb)
+        channel.fill(-1);
+    controlPending.fill(0);
+    parameterMsb.fill(-1);
+    parameterLsb.fill(-1);
+    parameterRpn.fill(false);
+    dataMsb.fill(-1);
+    dataPending.fill(false);
+    numPending = 0;
+}
+
+int PythonAudioProcessor::MidiInputState::getParameterKey(size_t channel) const
+{
+    // no parameter selected, or the RPN null parameter
+    if (parameterMsb[channel] < 0 || parameterLsb[channel] < 0 || isNullParameter(channel))
+        return -1;
+    return (parameterRpn[channel] ? 0x4000 : 0) | (parameterMsb[channel] << 7) | parameterLsb[channel];
+}
+
+bool PythonAudioProcessor::pairController(Arguments& args, uint32_t hooks, int channel, int controller, int value)
+{
+    auto& state = args.midiState;
+    auto& inputs = args.midiInputs;
+
+    // 14-bit controllers, the MSB waits for its LSB, a lone LSB refines the last MSB
+    if ((hooks & HookProcessMidiControls) && state.controllers14 != 0 && controller < 64) {
+        const int msbController = controller & 31;
+        if ((state.controllers14 & (1u << msbController)) != 0) {
+            const uint32_t bit = 1u << msbController;
+            auto& msb = state.controlMsb[(size_t)channel][(size_t)msbController];
+            if (controller < 32) {
+                if ((state.controlPending[(size_t)channel] & bit) == 0) {
+                    state.controlPending[(size_t)channel] |= bit;
+                    ++state.numPending;
+                }
+                msb = value;
             }
+            else if (msb >= 0) {
+                if ((state.controlPending[(size_t)channel] & bit) != 0) {
+                    state.controlPending[(size_t)channel] &= ~bit;
+                    --state.numPending;
+                }
+                setItem(inputs[MidiInputControls], msbController, (msb << 7) | value);
+            }
+            return true;
         }
-        else {
-            // @todo: pass-through audio (copy data)
-        }
-
-        // prepare midi input
-        for (auto metaData : midiMessages) {
-            auto message = metaData.getMessage();
-            const int messageSize = message.getRawDataSize();
-            const int channel = 1 - 1;
-            const juce::uint8* messageData = message.getRawData();
-            // filter MIDI cc input through Python
-            if (processMidiControls && message.isController()) {
-                const juce::uint8* payload = &messageData[1];
-                midiControlInputs[py::int_(payload[0])] = payload[1];
+    }
+
+    if ((hooks & HookProcessMidiParameters) == 0)
+        return false;
+
+    const auto c = (size_t)channel;
+    switch (controller) {
+        case 99:
+        case 101:
+            state.parameterRpn[c] = controller == 101;
+            state.parameterMsb[c] = value;
+            return !state.isNullParameter(c);
+        case 98:
+        case 100:
+            state.parameterRpn[c] = controller == 100;
+            state.parameterLsb[c] = value;
+            return !state.isNullParameter(c);
+        case 6:
+            // data entry without a selected parameter is an ordinary controller
+            if (state.getParameterKey(c) < 0)
+                return false;
+            if (!state.dataPending[c]) {
+                state.dataPending[c] = true;
+                ++state.numPending;
             }
-            // filter MIDI note on through Python
-            else if (processMidiNotes && message.isNoteOn()) {
-                const juce::uint8* payload = &messageData[1];
-                midiNoteOnInputs[py::int_(payload[0])] = payload[1];
+            state.dataMsb[c] = value;
+            return true;
+        case 38:
+            if (state.getParameterKey(c) < 0)
+                return false;
+            if (state.dataPending[c]) {
+                state.dataPending[c] = false;
+                --state.numPending;
             }
-            // filter MIDI note off through Python
-            else if (processMidiNotes && !message.isNoteOn()) {
-                const juce::uint8* payload = &messageData[1];
-                midiNoteOffInputs[py::int_(payload[0])] = payload[1];
+            if (state.dataMsb[c] >= 0 && state.getParameterKey(c) >= 0)
+                setItem(inputs[MidiInputParameters], state.getParameterKey(c), (state.dataMsb[c] << 7) | value);
+            return true;
+        default:
+            return false;
+    }
+}
+
+void PythonAudioProcessor::flushPairs(Arguments& args)
+{
+    auto& state = args.midiState;
+    auto& inputs = args.midiInputs;
+
+    for (size_t channel = 0; channel < 16; ++channel) {
+        for (auto controller = 0; controller < 32 && state.controlPending[channel] != 0; ++controller) {
+            if ((state.controlPending[channel] & (1u << controller)) != 0) {
+                setItem(inputs[MidiInputControls], controller, state.controlMsb[channel][(size_t)controller] << 7);
+                state.controlPending[channel] &= ~(1u << controller);
             }
-            else if (processProgramChanges && message.isProgramChange()) {
-                const juce::uint8* payload = &messageData[1];
-                midiProgramChangeInputs[py::int_(payload[0])] = payload[1];
+        }
+
+        if (state.dataPending[channel] && state.getParameterKey(channel) >= 0)
+            setItem(inputs[MidiInputParameters], state.getParameterKey(channel), state.dataMsb[channel] << 7);
+        state.dataPending[channel] = false;
+    }
+
+    state.numPending = 0;
+}
+
+void PythonAudioProcessor::callMidiHooks(Arguments& args, uint32_t hooks, py::dict& midiOutputs)
+{
+    // each function is only called when there's input for it
+    auto& inputs = args.midiInputs;
+    auto hasInput = [&inputs](int input) { return py::len(inputs[input]) > 0; };
+    if ((hooks & HookProcessMidiControls) && hasInput(MidiInputControls))
+        args.processMidiControls(inputs[MidiInputControls], midiOutputs);
+    if ((hooks & HookProcessMidiNotes) && hasInput(MidiInputNoteOns))
+        args.processMidiNotes(inputs[MidiInputNoteOns], true, midiOutputs);
+    if ((hooks & HookProcessMidiNotes) && hasInput(MidiInputNoteOffs))
+        args.processMidiNotes(inputs[MidiInputNoteOffs], false, midiOutputs);
+    if ((hooks & HookProcessProgramChanges) && hasInput(MidiInputProgramChanges))
+        args.processProgramChanges(inputs[MidiInputProgramChanges], midiOutputs);
+    if ((hooks & HookProcessPitchBend) && hasInput(MidiInputPitchBends))
+        args.processPitchBend(inputs[MidiInputPitchBends], midiOutputs);
+    if ((hooks & HookProcessChannelPressure) && hasInput(MidiInputChannelPressures))
+        args.processChannelPressure(inputs[MidiInputChannelPressures], midiOutputs);
+    if ((hooks & HookProcessPolyPressure) && hasInput(MidiInputPolyPressures))
+        args.processPolyPressure(inputs[MidiInputPolyPressures], midiOutputs);
+    if ((hooks & HookProcessTransport) && hasInput(MidiInputTransport))
+        args.processTransport(inputs[MidiInputTransport], midiOutputs);
+    if ((hooks & HookProcessSysEx) && hasInput(MidiInputSysEx))
+        args.processSysEx(inputs[MidiInputSysEx], midiOutputs);
+    if ((hooks & HookProcessMidiParameters) && hasInput(MidiInputParameters))
+        args.processMidiParameters(inputs[MidiInputParameters], midiOutputs);
+}
+
+template <typename SampleType>
+void PythonAudioProcessor::process(AudioBuffer<SampleType>& buffer, MidiBuffer& midiMessages)
+{
+    ScopedNoDenormals noDenormals;
+
+    auto totalNumInputChanenls = getTotalNumInputChannels();
+    auto totalNumOutputChannels = getTotalNumOutputChannels();
+
+    m_trace.recordInput(buffer, midiMessages, getPlayHead());
+
+    // control rate ticks are scheduled in samples, independent of the block size
+    const uint32_t activeHooks = m_hooks.load() | m_stageHooks.load();
+    if (m_controlReset.exchange(false)) {
+        m_controlSamples = 0;
+        m_controlTicks = 0;
+    }
+    const double controlPeriod = getControlPeriod();
+    const bool controlDue = (activeHooks & HookProcessControl) && controlPeriod > 0.0
+        && (double)getNextControlTick(controlPeriod) * controlPeriod < (double)(m_controlSamples + buffer.getNumSamples());
+
+    // snapshot the host's transport, scripts see it once it's published under the lock
+    updateTransport();
+
+    // fast path: nothing for the script to do, so pass audio and midi through without entering the interpreter
+    if (!controlDue && isIdle(midiMessages, activeHooks)) {
+        for (auto i = totalNumInputChanenls; i < totalNumOutputChannels; ++i)
+            buffer.clear(i, 0, buffer.getNumSamples());
+        m_controlSamples += buffer.getNumSamples();
+        // keep the position current for scripts running elsewhere, unless that means waiting
+        PythonExecutor::tryExclusive([this]() { publishTransport(); });
+        m_trace.recordOutput(midiMessages);
+        return;
+    }
+
+    // with the shared scheduler a worker runs the script, the block passes through if it can't start within budget
+    if (auto* scheduler = PythonScheduler::getInstance()) {
+        const double sampleRate = getSampleRate();
+        const double budget = sampleRate > 0.0 && !isNonRealtime() ? m_budget.load() * buffer.getNumSamples() / sampleRate : 0.0;
+        m_jobBuffer = &buffer;
+        m_jobMidi = &midiMessages;
+        m_job.run = [](void* context) {
+            auto* processor = static_cast<PythonAudioProcessor*>(context);
+            processor->processScript(*static_cast<AudioBuffer<SampleType>*>(processor->m_jobBuffer), *processor->m_jobMidi, processor->m_job.deadline);
+        };
+        m_job.context = this;
+        m_job.deadline = budget > 0.0 ? Time::getHighResolutionTicks() + Time::secondsToHighResolutionTicks(budget) : 0;
+        scheduler->submit(m_job);
+        if (!scheduler->wait(m_job)) {
+            for (auto i = totalNumInputChanenls; i < totalNumOutputChannels; ++i)
+                buffer.clear(i, 0, buffer.getNumSamples());
+            ++m_overruns;
+        }
+    }
+    else {
+        processScript(buffer, midiMessages);
+    }
+
+    m_controlSamples += buffer.getNumSamples();
+
+    m_trace.recordOutput(midiMessages);
+}
+
+template <typename SampleType>
+void PythonAudioProcessor::processScript(AudioBuffer<SampleType>& buffer, MidiBuffer& midiMessages, int64 deadline)
+{
+    ScopedNoDenormals noDenormals;
+
+    auto totalNumInputChanenls = getTotalNumInputChannels();
+    auto totalNumOutputChannels = getTotalNumOutputChannels();
+
+    // offline rendering (bounce/freeze) lifts the callback budget and only takes a shared lock, so instances
+    // rendering on other threads can run while this one is in native code with the GIL released
+    const bool offline = isNonRealtime();
+
+    PythonExecutor::lock(!offline);
+
+    // the transport is only written while holding the GIL, so no script sees a partly updated position
+    publishTransport();
+
+    // let scripts know when they're rendering offline, e.g. to skip visualizations
+    if (offline != m_offline) {
+        m_offline = offline;
+        try {
+            PythonExecutor::bind("offline", py::bool_(offline));
+            for (auto& stage : m_stages)
+                stage.module.attr("__dict__")["offline"] = py::bool_(offline);
+        }
+        catch (...) {
+        }
+    }
+
+    bool failed = false;
+    try {
+        auto& args = m_arguments;
+        m_processedMidi.clear();
+
+        // processing functions defined by the script, none while it's being replaced
+        const uint32_t hooks = m_hooks.load();
+        bool processAudio = ((hooks | m_stageHooks.load()) & HookProcessAudio) != 0;
+        const bool processMidiControls = (hooks & HookProcessMidiControls) != 0;
+
+        // prepare audio, the channels of all buses are presented as [channel, sample] arrays (see getBusInfo)
+        const auto numSamples = buffer.getNumSamples();
+        ptrdiff_t stride = numSamples;
+        bool gather = false;
+        if (processAudio) {
+            // outputs which don't share a channel with an input hold garbage
+            for (auto i = totalNumInputChanenls; i < totalNumOutputChannels; ++i)
+                buffer.clear(i, 0, numSamples);
+
+            // view the host's memory directly when possible, otherwise gather into contiguous scratch memory
+            SampleType* data = buffer.getNumChannels() > 0 ? buffer.getWritePointer(0) : nullptr;
+            gather = !getChannelStride(buffer, stride);
+            if (gather) {
+                auto& scratch = std::get<std::vector<SampleType>>(m_scratch);
+                stride = numSamples;
+                // a block larger than prepareToPlay reserved for passes through rather than allocating here
+                gather = processAudio = scratch.size() >= (size_t)(buffer.getNumChannels() * numSamples);
+                if (gather) {
+                    for (auto i = 0; i < buffer.getNumChannels(); ++i)
+                        FloatVectorOperations::copy(&scratch[(size_t)(i * numSamples)], buffer.getReadPointer(i), numSamples);
+                    data = scratch.data();
+                }
             }
-            // pass through all unhandled MIDI events
-            else {
-                processedMidi.addEvent(message, midiMessages.getLastEventTime());
+
+            // hosts generally reuse the same buffer, so the arrays only need recreating when it moves or changes shape
+            if (processAudio && (data != args.audioData || sizeof(SampleType) != args.audioSampleSize || numSamples != args.audioNumSamples
+                || stride != args.audioStride || totalNumInputChanenls != args.audioNumInputs || totalNumOutputChannels != args.audioNumOutputs)) {
+                args.audioInputs = createChannelArray(data, totalNumInputChanenls, numSamples, stride);
+                args.audioOutputs = createChannelArray(data, totalNumOutputChannels, numSamples, stride);
+                args.audioData = data;
+                args.audioSampleSize = sizeof(SampleType);
+                args.audioNumSamples = numSamples;
+                args.audioStride = stride;
+                args.audioNumInputs = totalNumInputChanenls;
+                args.audioNumOutputs = totalNumOutputChannels;
             }
         }
+        else {
+            // pass-through audio (inputs share the buffer with outputs, so only surplus outputs are cleared)
+            for (auto i = totalNumInputChanenls; i < totalNumOutputChannels; ++i)
+                buffer.clear(i, 0, buffer.getNumSamples());
+        }
 
-        // optional audio processing
-        if (dict.contains("processAudio"))
-            dict["processAudio"](audioInputs, audioOutputs);
+        // parameter values for this block
+        updateParameters(numSamples);
 
-        // optional midi control change processing
-        if (processMidiControls && !midiControlInputs.empty())
-            dict["processMidiControls"](midiControlInputs, midiOutputs);
+        // with a pipeline the script's midi goes to the first stage rather than the host
+        auto midiOutputs = py::reinterpret_borrow<py::dict>(args.midiOutputs);
+        if (hooks != 0)
+            midiOutputs.clear();
+        if (m_stages.empty()) {
+            dispatchMidi(midiMessages, args, hooks, m_processedMidi);
+        }
+        else {
+            m_stageEvents[0].clear();
+            dispatchMidi(midiMessages, args, hooks, m_stageEvents[0]);
+        }
 
-        // optional midi note processing
-        if (processMidiNotes && !midiNoteOnInputs.empty())
-            dict["processMidiNotes"](midiNoteOnInputs, true, midiOutputs);
-        if (processMidiNotes && !midiNoteOffInputs.empty())
-            dict["processMidiNotes"](midiNoteOffInputs, false, midiOutputs);
+        // the script's processing functions must complete within the block's budget, or what's left of it when a
+        // scheduler worker picked the block up (see PythonWatchdog)
+        const double sampleRate = getSampleRate();
+        if (deadline != 0)
+            PythonExecutor::beginCallbackUntil(deadline);
+        else
+            PythonExecutor::beginCallback(sampleRate > 0.0 && !offline ? m_budget.load() * numSamples / sampleRate : 0.0);
 
-        // optional program change processing
-        if (processProgramChanges && !midiProgramChangeInputs.empty())
-            dict["processProgramChanges"](midiProgramChangeInputs, midiOutputs);
+        // optional audio and midi processing
+        if ((hooks & HookProcessAudio) && processAudio)
+            args.processAudio(args.audioInputs, args.audioOutputs);
+        callMidiHooks(args, hooks, midiOutputs);
+
+        // control rate processing, at sample accurate offsets within the block
+        if (hooks & HookProcessControl)
+            processControlTicks(numSamples);
 
         // process midi output
-        for (auto item : midiOutputs) {
-            // parse index/value
-            const auto outputIdx = item.first.cast<juce::uint8>();
-            const auto outputValue = item.second.cast<juce::uint8>();
-            // skip invalid outputs
-            if (outputIdx >= m_outputs.size())
-                continue;
-            // reconstruct the midi message for this output
-            const std::tuple<std::string, std::string> tuple = m_outputs[outputIdx];
-            const std::string rawMessage = std::get<0>(tuple) + (char)outputValue + std::get<1>(tuple);
-            const MidiMessage message(rawMessage.c_str(), (int)rawMessage.length());
-            // skip cc values which haven't changed (midi cc pickup)
-            if (message.isController() && dict.contains("processMidiControls")) {
-                const auto cc = message.getControllerNumber();
-                const auto value = message.getControllerValue();
-                if (m_PrevMidiOutputs.find(cc) != m_PrevMidiOutputs.end() && value == m_PrevMidiOutputs[cc])
-                    continue;
-                // update previous midi outputs state
-                m_PrevMidiOutputs[cc] = value;
-            }
-            // send the output event!
-            processedMidi.addEvent(message, (int)midiMessages.getLastEventTime());
+        if (hooks != 0)
+            addMidiOutputs(midiOutputs, midiMessages.getLastEventTime(), processMidiControls, false);
+
+        // the rest of the pipeline, within the same lock and callback budget
+        if (!m_stages.empty())
+            processPipeline(processAudio);
+
+        // scatter gathered output back to the host's channels
+        if (gather) {
+            const auto& scratch = std::get<std::vector<SampleType>>(m_scratch);
+            for (auto i = 0; i < totalNumOutputChannels; ++i)
+                FloatVectorOperations::copy(buffer.getWritePointer(i), &scratch[(size_t)(i * numSamples)], numSamples);
         }
 
-        midiMessages.swapWith(processedMidi);
+        // hand the processed events to the host, and make sure the storage we get back is reserved too
+        midiMessages.swapWith(m_processedMidi);
+        m_processedMidi.ensureSize(midiReserveBytes);
+    }
+    catch (const std::exception& e) {
+        failed = true;
+        getLog().writeLine(PythonLog::LevelError, e.what());
     }
     catch (...) {
+        failed = true;
+    }
+
+    // on overrun the script was interrupted, output silence and pass midi through unprocessed
+    if (PythonExecutor::endCallback()) {
+        if (failed)
+            buffer.clear();
+        ++m_overruns;
+        // repeated overruns disable the script until it's executed again
+        if (++m_consecutiveOverruns >= maxConsecutiveOverruns) {
+            m_hooks = 0;
+            m_stageHooks = 0;
+            getLog().writeLine(PythonLog::LevelError, "script disabled after repeated overruns, execute it again to re-enable");
+        }
+    }
+    else {
+        m_consecutiveOverruns = 0;
     }
 
     PythonExecutor::unlock();
 }
 
+void PythonAudioProcessor::updateParameters(int numSamples)
+{
+    if (m_numParameters == 0)
+        return;
+
+    auto& args = m_arguments;
+    const double sampleRate = getSampleRate();
+
+    // before prepareToPlay, or for a block larger than prepared for, values jump rather than ramp
+    const bool ramps = numSamples <= m_parameterBufferSamples;
+
+    for (auto i = 0; i < m_numParameters; ++i) {
+        auto& parameter = m_parameters[(size_t)i];
+
+        // start a linear ramp whenever the host moves the parameter, newly claimed parameters start in place
+        const float target = parameter.minimum + parameter.value->load(std::memory_order_relaxed) * (parameter.maximum - parameter.minimum);
+        if (parameter.snap || !ramps) {
+            parameter.current = parameter.target = target;
+            parameter.remaining = 0;
+            parameter.snap = false;
+        }
+        else if (target != parameter.target) {
+            parameter.target = target;
+            parameter.remaining = jmax(1, (int)(parameter.smoothingSeconds * sampleRate));
+            parameter.step = (target - parameter.current) / (float)parameter.remaining;
+        }
+
+        py::object value;
+        if (parameter.remaining > 0) {
+            // current + step * (1, 2, 3, ...) for the rest of the ramp, then the target
+            float* buffer = m_parameterBuffers + i * m_parameterBufferSamples;
+            const int ramp = jmin(parameter.remaining, numSamples);
+            FloatVectorOperations::copyWithMultiply(buffer, m_ramp, parameter.step, ramp);
+            FloatVectorOperations::add(buffer, parameter.current, ramp);
+            parameter.remaining -= ramp;
+            parameter.current = parameter.remaining > 0 ? buffer[ramp - 1] : parameter.target;
+            FloatVectorOperations::fill(buffer + ramp, parameter.current, numSamples - ramp);
+
+            if (args.parameterViewSamples[(size_t)i] != numSamples) {
+                py::str dummy; // prevent pybind11 from copying
+                args.parameterViews[(size_t)i] = py::array(py::dtype::of<float>(), { numSamples }, {}, buffer, dummy);
+                args.parameterViewSamples[(size_t)i] = numSamples;
+            }
+            value = args.parameterViews[(size_t)i];
+        }
+        else {
+            // a settled value reuses its float, a changed one takes one from Python's float free list
+            auto& scalar = args.parameterScalars[(size_t)i];
+            if (!scalar || args.parameterScalarValues[(size_t)i] != parameter.current) {
+                scalar = py::float_(parameter.current);
+                args.parameterScalarValues[(size_t)i] = parameter.current;
+            }
+            value = scalar;
+        }
+
+        PyDict_SetItem(args.parameters.ptr(), args.parameterKeys[(size_t)i].ptr(), value.ptr());
+    }
+}
+
+double PythonAudioProcessor::getControlPeriod() const
+{
+    const double sampleRate = getSampleRate();
+    return sampleRate > 0.0 ? sampleRate / jlimit(1.0, sampleRate, m_controlRate.load()) : 0.0;
+}
+
+int64 PythonAudioProcessor::getNextControlTick(double period) const
+{
+    // ticks which fell in a block that failed before reaching them are skipped rather than delivered late
+    return std::max(m_controlTicks, (int64)std::ceil((double)m_controlSamples / period));
+}
+
+void PythonAudioProcessor::processControlTicks(int numSamples)
+{
+    const double period = getControlPeriod();
+    if (period <= 0.0)
+        return;
+
+    const double rate = getSampleRate() / period;
+    auto outputs = py::reinterpret_borrow<py::dict>(m_arguments.controlOutputs);
+
+    // ticks sit at absolute sample positions, so an exception part way through doesn't shift the schedule
+    m_controlTicks = getNextControlTick(period);
+    while ((double)m_controlTicks * period < (double)(m_controlSamples + numSamples)) {
+        // advance first, so a failing script doesn't stall the schedule
+        const int samplePosition = jlimit(0, numSamples - 1, (int)((double)m_controlTicks * period - (double)m_controlSamples));
+        const double time = (double)m_controlTicks / rate;
+        ++m_controlTicks;
+
+        outputs.clear();
+        m_arguments.processControl(time, outputs);
+        addMidiOutputs(outputs, samplePosition, false, true);
+    }
+}
+
+void PythonAudioProcessor::processPipeline(bool processAudio)
+{
+    for (size_t i = 0; i < m_stages.size(); ++i) {
+        auto& stage = m_stages[i];
+        auto& args = stage.arguments;
+
+        // stages alternate between the two event lists, the last one writes the processed midi
+        auto run = [&](const MidiEvents& input, auto& output) {
+            auto midiOutputs = py::reinterpret_borrow<py::dict>(args.midiOutputs);
+            if (stage.hooks != 0)
+                midiOutputs.clear();
+            dispatchMidi(input, args, stage.hooks, output);
+
+            // audio is processed in place, so each stage sees the previous stage's output
+            if ((stage.hooks & HookProcessAudio) && processAudio)
+                args.processAudio(m_arguments.audioInputs, m_arguments.audioOutputs);
+            callMidiHooks(args, stage.hooks, midiOutputs);
+
+            if (stage.hooks != 0)
+                addMidiOutputs(midiOutputs, stage.outputs, stage.outputState, nullptr, input.getLastEventTime(),
+                    (stage.hooks & HookProcessMidiControls) != 0, output);
+        };
+
+        auto& input = m_stageEvents[i % 2];
+        if (i + 1 == m_stages.size()) {
+            run(input, m_processedMidi);
+        }
+        else {
+            auto& output = m_stageEvents[(i + 1) % 2];
+            output.clear();
+            run(input, output);
+        }
+    }
+}
+
+void PythonAudioProcessor::addMidiOutputs(const py::dict& outputs, int samplePosition, bool pickup, bool coalesce)
+{
+    auto controlValues = coalesce ? &m_controlValues : nullptr;
+    if (m_stages.empty())
+        addMidiOutputs(outputs, m_outputs, m_outputState, controlValues, samplePosition, pickup, m_processedMidi);
+    else
+        addMidiOutputs(outputs, m_outputs, m_outputState, controlValues, samplePosition, pickup, m_stageEvents[0]);
+}
+
+template <typename Sink>
+void PythonAudioProcessor::addMidiOutputs(const py::dict& outputs, std::vector<MidiOutput>& templates, MidiOutputState& state,
+    std::vector<int>* controlValues, int samplePosition, bool pickup, Sink& sink)
+{
+    for (auto item : outputs) {
+        // parse index/value
+        const auto outputIdx = item.first.cast<size_t>();
+        // skip invalid outputs
+        if (outputIdx >= templates.size())
+            continue;
+        auto& output = templates[outputIdx];
+        // values are clamped to the range of the output, 7 bits for a template's data byte
+        const int outputValue = jlimit(0, output.type == MidiOutput::TypeTemplate ? 127 : 0x3fff, item.second.cast<int>());
+        // skip control rate outputs which haven't changed since the last tick
+        if (controlValues != nullptr && outputIdx < controlValues->size()) {
+            if ((*controlValues)[outputIdx] == outputValue)
+                continue;
+            (*controlValues)[outputIdx] = outputValue;
+        }
+
+        if (output.type != MidiOutput::TypeTemplate) {
+            if (pickup && outputValue == output.lastValue)
+                continue;
+            addMidiOutput14(output, state, outputValue, samplePosition, sink);
+            continue;
+        }
+
+        // fill in the value of this output's message
+        output.message[output.valueIndex] = (juce::uint8)outputValue;
+        const juce::uint8* message = output.message.data();
+        const int messageSize = (int)output.message.size();
+        // skip cc values which haven't changed (midi cc pickup)
+        if (pickup && messageSize >= 3 && (message[0] & 0xf0) == 0xb0 && message[1] < 128) {
+            const auto cc = message[1];
+            const auto value = message[2];
+            if (value == state.controls[cc])
+                continue;
+            // update previous midi outputs state
+            state.controls[cc] = value;
+        }
+        // send the output event!
+        sink.addEvent(message, messageSize, samplePosition);
+    }
+}
+
+template <typename Sink>
+void PythonAudioProcessor::addMidiOutput14(MidiOutput& output, MidiOutputState& state, int value, int samplePosition, Sink& sink)
+{
+    // every message is a controller on the output's channel, so a sequence shares one running status
+    const juce::uint8 status = (juce::uint8)(0xb0 | output.channel);
+    auto send = [&](int controller, int data) {
+        const juce::uint8 message[] = { status, (juce::uint8)controller, (juce::uint8)data };
+        sink.addEvent(message, 3, samplePosition);
+    };
+
+    // the parameter number is only sent when a different parameter was selected last on this channel
+    bool selected = false;
+    if (output.type != MidiOutput::TypeController14) {
+        const int key = (output.type == MidiOutput::TypeRpn ? 0x4000 : 0) | output.number;
+        auto& current = state.parameters[(size_t)output.channel];
+        if (current != key) {
+            const bool rpn = output.type == MidiOutput::TypeRpn;
+            send(rpn ? 101 : 99, output.number >> 7);
+            send(rpn ? 100 : 98, output.number & 0x7f);
+            current = key;
+            selected = true;
+        }
+    }
+
+    // MSB then LSB, the MSB is skipped when it hasn't changed since this output last sent it (an LSB alone
+    // refines the current MSB)
+    const int msbController = output.type == MidiOutput::TypeController14 ? output.number : 6;
+    if (selected || output.lastValue < 0 || (output.lastValue >> 7) != (value >> 7))
+        send(msbController, value >> 7);
+    send(msbController + 32, value & 0x7f);
+    output.lastValue = value;
+}
+
+void PythonAudioProcessor::processBlock(AudioBuffer<float>& buffer, MidiBuffer& midiMessages) { process(buffer, midiMessages); }
+
+void PythonAudioProcessor::processBlock(AudioBuffer<double>& buffer, MidiBuffer& midiMessages) { process(buffer, midiMessages); }
+
 void PythonAudioProcessor::getStateInformation(MemoryBlock& destData)
 {
     // update parameter state
@@ -244,6 +1413,12 @@ void PythonAudioProcessor::getStateInformation(MemoryBlock& destData)
     m_vts.state.setProperty("editorWidth", m_editorWidth, &m_undoManager);
     m_vts.state.setProperty("editorHeight", m_editorHeight, &m_undoManager);
 
+    // save which script parameter each pool parameter holds, so restored values survive re-executing the script
+    StringArray names;
+    for (auto& parameter : m_parameters)
+        names.add(parameter.parameter->getScriptName());
+    m_vts.state.setProperty("parameterNames", names.joinIntoString("\n"), &m_undoManager);
+
     // save globals dictionary
     PythonExecutor::lock();
     try {
@@ -284,6 +1459,12 @@ void PythonAudioProcessor::setStateInformation(const void* data, int sizeInBytes
     m_editorWidth = m_editorWidth ? m_editorWidth : 1024;
     m_editorHeight = m_vts.state.getProperty("editorHeight");
     m_editorHeight = m_editorHeight ? m_editorHeight : 768;
+
+    // restore parameter names
+    StringArray names;
+    names.addTokens(m_vts.state.getProperty("parameterNames").toString(), "\n", "");
+    for (auto i = 0; i < maxParameters; ++i)
+        m_parameters[(size_t)i].parameter->setScriptName(i < names.size() ? names[i] : String());
 }
 
 AudioProcessorEditor* PythonAudioProcessor::createEditor() { return new PythonAudioProcessorEditor(*this, m_editorWidth, m_editorHeight); }
@@ -9,8 +9,10 @@
 #include "apu_python.h"
 
 #include <vector>
+#include <array>
 #include <tuple>
 #include <set>
+#include <atomic>
 
 //
 // PythonAudioProcessor
@@ -37,8 +39,13 @@ public:
 
     // AudioProcessor interface implementation (playback)
     void prepareToPlay(double sampleRate, int samplesPerBlock) override;
-    void releaseResources() override {}
+    void releaseResources() override;
     void processBlock(AudioBuffer<float>&, MidiBuffer&) override;
+    void processBlock(AudioBuffer<double>&, MidiBuffer&) override;
+    bool supportsDoublePrecisionProcessing() const override { return true; }
+
+    // AudioProcessor interface implementation (buses)
+    bool isBusesLayoutSupported(const BusesLayout& layouts) const override;
 
     // AudioProcessor interface implementation (midi, general)
     bool acceptsMidi() const override { return JucePlugin_WantsMidiInput; }
@@ -63,7 +70,166 @@ public:
 
     PythonEditor& getPythonEditor() { return m_pythonEditor; }
 
+    // number of blocks where the script overran its budget
+    int getOverrunCount() const { return m_overruns; }
+
+    // record processed blocks to a trace file for later replay (see TraceRecorder)
+    bool startTrace(const File& file, bool recordAudio);
+    void stopTrace();
+
+protected:
+    // PythonExecutor interface
+    void prepareContext(py::dict scope) override;
+
 private:
+    // describe the bus layout to scripts as { 'inputs': [(name, channel, count), ...], 'outputs': [...] }
+    py::dict getBusInfo();
+    // rebind the context into the running script and its pipeline stages, call while locked
+    void rebindContext();
+
+    //
+    // Host-automatable parameters
+    //
+    // Hosts expect a fixed parameter list, so the processor registers a pool of generic parameters which scripts
+    // claim in order by declaring them in getParameters(), e.g. [('gain', 0.0, 1.0, 0.5), ...] with an optional
+    // fifth element giving the smoothing time in seconds. Hooks see them in the 'params' dict, as a per-sample
+    // float32 array while a parameter is ramping towards a new value, or as a float when it's steady.
+    //
+
+    static constexpr int maxParameters = 32;
+
+    // pool parameter whose display name and range are taken from the script which claimed it, hosts still see a
+    // normalized 0..1 value but display and accept text in the script's range
+    class ScriptParameter : public AudioParameterFloat
+    {
+    public:
+        ScriptParameter(int index);
+
+        void setScriptName(const String& name, float minimum = 0.0f, float maximum = 1.0f);
+        String getScriptName() const;
+
+        // AudioProcessorParameter interface implementation
+        String getName(int maximumStringLength) const override;
+        String getText(float normalisedValue, int maximumStringLength) const override;
+        float getValueForText(const String& text) const override;
+
+    private:
+        mutable SpinLock m_lock;
+        String m_scriptName;
+        float m_minimum = 0.0f;
+        float m_maximum = 1.0f;
+    };
+
+    // per-parameter mapping and smoothing state, the mapping is guarded by the lock and the smoothing state is
+    // only touched on the audio thread
+    struct Parameter
+    {
+        ScriptParameter* parameter = nullptr;
+        std::atomic<float>* value = nullptr;
+        float minimum = 0.0f;
+        float maximum = 1.0f;
+        double smoothingSeconds = 0.02;
+        bool snap = true;
+        float current = 0.0f;
+        float target = 0.0f;
+        float step = 0.0f;
+        int remaining = 0;
+    };
+
+    static AudioProcessorValueTreeState::ParameterLayout createParameterLayout();
+
+    // advance parameter smoothing by a block and update the 'params' dict
+    void updateParameters(int numSamples);
+
+    // host transport state, read once per block and exposed to scripts as the structured array 'transport', a view
+    // of this memory which is only updated while no script can be reading it (see publishTransport)
+    struct Transport
+    {
+        double bpm = 120.0;
+        double ppqPosition = 0.0;
+        double ppqPositionOfLastBarStart = 0.0;
+        double ppqLoopStart = 0.0;
+        double ppqLoopEnd = 0.0;
+        int64 timeInSamples = 0;
+        int32 timeSigNumerator = 4;
+        int32 timeSigDenominator = 4;
+        bool isPlaying = false;
+        bool isRecording = false;
+        bool isLooping = false;
+        // false if the host didn't provide a position for this block
+        bool isValid = false;
+    };
+
+    py::array createTransportArray();
+    // read the play head into the pending transport (audio thread)
+    void updateTransport();
+    // copy the pending transport into the memory scripts view, call while locked
+    void publishTransport() { m_transport = m_hostTransport; }
+
+    // processing functions defined by the script
+    enum Hooks : uint32_t
+    {
+        HookProcessAudio = 1 << 0,
+        HookProcessMidiControls = 1 << 1,
+        HookProcessMidiNotes = 1 << 2,
+        HookProcessProgramChanges = 1 << 3,
+        HookProcessPitchBend = 1 << 4,
+        HookProcessChannelPressure = 1 << 5,
+        HookProcessPolyPressure = 1 << 6,
+        HookProcessTransport = 1 << 7,
+        HookProcessSysEx = 1 << 8,
+        HookProcessControl = 1 << 9,
+        HookProcessMidiParameters = 1 << 10
+    };
+
+    // midi message types collected for the script, each in its own input container, pitch bend and channel pressure
+    // are keyed by channel, 1-16 like everywhere else scripts see a channel (output declarations, apu.shared)
+    enum MidiInput
+    {
+        MidiInputControls,
+        MidiInputNoteOns,
+        MidiInputNoteOffs,
+        MidiInputProgramChanges,
+        MidiInputPitchBends,
+        MidiInputChannelPressures,
+        MidiInputPolyPressures,
+        MidiInputTransport,
+        MidiInputSysEx,
+        // NRPN/RPN values assembled from controller sequences, see MidiInputState
+        MidiInputParameters,
+        NumMidiInputs
+    };
+
+    // where messages with a given status byte go, messages whose hook isn't defined pass straight through
+    struct MidiRoute
+    {
+        uint32_t hook;
+        int input;
+    };
+    static const std::array<MidiRoute, 256> g_midiRoutes;
+
+    // returns true if none of the given hooks would be called for this block
+    static bool isIdle(const MidiBuffer& midiMessages, uint32_t hooks);
+
+    // process a block in the host's sample precision, scripts receive arrays of the same type (float32/float64)
+    template <typename SampleType>
+    void process(AudioBuffer<SampleType>& buffer, MidiBuffer& midiMessages);
+    // the part of process which enters the interpreter, on the audio thread or a scheduler worker (see PythonScheduler),
+    // the script runs within the block's budget, or by the job's deadline (high resolution ticks) if there is one
+    template <typename SampleType>
+    void processScript(AudioBuffer<SampleType>& buffer, MidiBuffer& midiMessages, int64 deadline = 0);
+
+    // call processControl for each control rate tick falling within the next numSamples samples
+    void processControlTicks(int numSamples);
+    // samples between control rate ticks (0 before the sample rate is known), and the next tick to deliver
+    double getControlPeriod() const;
+    int64 getNextControlTick(double period) const;
+
+    // append the script's midi outputs to the processed midi at the given sample position, optionally skipping cc
+    // values which haven't changed (pickup) or outputs whose value hasn't changed since the last control tick, values
+    // are clamped to 0-127 (templates) or 0-16383 (14-bit outputs)
+    void addMidiOutputs(const py::dict& outputs, int samplePosition, bool pickup, bool coalesce);
+
     // editor resources
     PythonEditor m_pythonEditor;
     std::string m_filename;
@@ -76,11 +242,311 @@ private:
     juce::AudioProcessorValueTreeState m_vts;
     juce::UndoManager m_undoManager;
 
-    // mapping from MIDI output index to MIDI output event (cc, prefix, suffix)
-    std::vector<std::tuple<std::string, std::string>> m_outputs;
+    // MIDI output, either a template whose 7-bit value is written at valueIndex, or a 14-bit controller, NRPN or RPN
+    // declared as ('cc14' | 'nrpn' | 'rpn', channel, number) which is sent as the matching controller sequence
+    struct MidiOutput
+    {
+        enum Type
+        {
+            TypeTemplate,
+            TypeController14,
+            TypeNrpn,
+            TypeRpn
+        };
+
+        Type type = TypeTemplate;
+        std::vector<juce::uint8> message;
+        size_t valueIndex = 0;
+        // channel (0-15), controller or parameter number, and the last value sent (-1 = none yet)
+        int channel = 0;
+        int number = 0;
+        int lastValue = -1;
+    };
+
+    // state of a script's midi output stream, -1 = none yet
+    struct MidiOutputState
+    {
+        MidiOutputState() { reset(); }
+        void reset()
+        {
+            controls.fill(-1);
+            parameters.fill(-1);
+        }
+
+        // previous value per cc, used to implement CC pickup for devices which don't (reliably) support it
+        std::array<int, 128> controls;
+        // NRPN/RPN selected per channel, so the parameter number is only sent when it changes
+        std::array<int, 16> parameters;
+    };
+
+    //
+    // 14-bit controller, NRPN and RPN input
+    //
+    // Controllers listed in a script's 'cc14_inputs' (0-31) are paired with their LSB controller (+32) and handed to
+    // processMidiControls as a single 14-bit value. A script defining processMidiParameters(inputs, outputs) gets
+    // NRPN values keyed by parameter number and RPN values keyed by apu.RPN + parameter number, assembled from the
+    // parameter select (99/98, 101/100) and data entry (6/38) controllers, which it no longer sees as controls.
+    // A MSB which isn't followed by its LSB within the block is delivered on its own. Data entry while no parameter
+    // is selected, and the select controller completing the null parameter (127/127), are delivered as ordinary
+    // controls, as are data increment/decrement (96/97) since the current value of a parameter isn't known. Loading a script starts from
+    // a fresh state.
+    //
+
+    struct MidiInputState
+    {
+        MidiInputState() { reset(); }
+        void reset();
+        // key of the selected NRPN/RPN (see apu.RPN), -1 if none
+        int getParameterKey(size_t channel) const;
+        // the RPN null parameter (127/127), which deselects
+        bool isNullParameter(size_t channel) const { return parameterMsb[channel] == 127 && parameterLsb[channel] == 127; }
+
+        // paired controllers, bit per controller 0-31
+        uint32_t controllers14 = 0;
+        // last MSB per channel and paired controller (-1 = none), and whether it's waiting for its LSB
+        std::array<std::array<int, 32>, 16> controlMsb;
+        std::array<uint32_t, 16> controlPending;
+        // selected parameter per channel, as received (-1 = none)
+        std::array<int, 16> parameterMsb;
+        std::array<int, 16> parameterLsb;
+        std::array<bool, 16> parameterRpn;
+        // last data entry MSB per channel (-1 = none), and whether it's waiting for its LSB
+        std::array<int, 16> dataMsb;
+        std::array<bool, 16> dataPending;
+        int numPending = 0;
+    };
+
+    // mapping from MIDI output index to MIDI output event
+    std::vector<MidiOutput> m_outputs;
+
+    // Python objects handed to the processing functions, created once per script and reused for every block so
+    // processBlock doesn't allocate in steady state (only touched while locked)
+    struct Arguments
+    {
+        // processing functions defined by the script
+        py::object processAudio;
+        py::object processMidiParameters;
+        py::object processMidiControls;
+        py::object processMidiNotes;
+        py::object processProgramChanges;
+        py::object processPitchBend;
+        py::object processChannelPressure;
+        py::object processPolyPressure;
+        py::object processTransport;
+        py::object processSysEx;
+        py::object processControl;
+
+        // midi input containers (see MidiInput) and output dictionary, cleared at the start of each block
+        std::array<py::object, NumMidiInputs> midiInputs;
+        MidiInputState midiState;
+        py::object midiOutputs;
+        py::object controlOutputs;
+
+        // audio arrays, only recreated when the host's buffer moves or changes shape
+        py::object audioInputs;
+        py::object audioOutputs;
+
+        // parameter dict, and each claimed parameter's key, per-sample view (recreated when the block size changes)
+        // and settled value (recreated when the value changes)
+        py::object parameters;
+        std::array<py::object, maxParameters> parameterKeys;
+        std::array<py::object, maxParameters> parameterViews;
+        std::array<int, maxParameters> parameterViewSamples{};
+        std::array<py::object, maxParameters> parameterScalars;
+        std::array<float, maxParameters> parameterScalarValues{};
+
+        const void* audioData = nullptr;
+        size_t audioSampleSize = 0;
+        int audioNumInputs = 0;
+        int audioNumOutputs = 0;
+        int audioNumSamples = 0;
+        ptrdiff_t audioStride = 0;
+    };
+    Arguments m_arguments;
+
+    // look up the processing functions a script defines and create its containers, returns its hooks
+    static uint32_t initArguments(const py::dict& dict, Arguments& args);
+    // build the midi output templates a script requests through getMidiOutputs(), raises ValueError for 14-bit
+    // outputs with a channel or number out of range
+    static std::vector<MidiOutput> getMidiOutputs(const py::dict& dict);
+
+    // hand midi events to a script's input containers, events it doesn't handle pass through to the sink
+    template <typename Events, typename Sink>
+    static void dispatchMidi(const Events& events, Arguments& args, uint32_t hooks, Sink& passThrough);
+    // pair 14-bit controller and NRPN/RPN input, returns false if the controller isn't consumed by pairing
+    static bool pairController(Arguments& args, uint32_t hooks, int channel, int controller, int value);
+    // deliver MSBs still waiting for their LSB at the end of a block
+    static void flushPairs(Arguments& args);
+    // call the script's midi processing functions which have input this block
+    static void callMidiHooks(Arguments& args, uint32_t hooks, py::dict& midiOutputs);
+    // append a script's midi outputs to the sink, see addMidiOutputs
+    template <typename Sink>
+    static void addMidiOutputs(const py::dict& outputs, std::vector<MidiOutput>& templates, MidiOutputState& state,
+        std::vector<int>* controlValues, int samplePosition, bool pickup, Sink& sink);
+    // send a 14-bit controller, NRPN or RPN value as its controller sequence
+    template <typename Sink>
+    static void addMidiOutput14(MidiOutput& output, MidiOutputState& state, int value, int samplePosition, Sink& sink);
+
+    //
+    // Pipeline
+    //
+    // A script can name further scripts in 'pipeline', e.g. pipeline = ['translate.py', 'synth.py'] (relative to
+    // its own directory). Each stage runs in its own module context, after the main script and within the same
+    // lock, seeing the midi the previous stage produced and processing the audio in place. Events are handed
+    // between stages in native lists, only the last stage writes to a MidiBuffer. Stages share the main script's
+    // context (sample_rate, transport, params, ...) but don't get processControl calls or claim parameters. Stage
+    // files and the helpers they import count as dependencies of the main script, editing one reloads the pipeline.
+    //
+
+    // midi events in native storage, reserved in prepareToPlay, iterated like a MidiBuffer
+    class MidiEvents
+    {
+    public:
+        void reserve(size_t bytes)
+        {
+            m_data.reserve(bytes);
+            m_events.reserve(bytes / 3);
+        }
+        void clear()
+        {
+            m_data.clear();
+            m_events.clear();
+            m_lastEventTime = 0;
+        }
+        void addEvent(const void* data, int numBytes, int samplePosition);
+        int getLastEventTime() const { return m_lastEventTime; }
+
+        struct Iterator
+        {
+            const MidiEvents* events;
+            size_t index;
+            MidiMessageMetadata operator*() const;
+            Iterator& operator++()
+            {
+                ++index;
+                return *this;
+            }
+            bool operator!=(const Iterator& other) const { return index != other.index; }
+        };
+        Iterator begin() const { return { this, 0 }; }
+        Iterator end() const { return { this, m_events.size() }; }
+
+    private:
+        struct Event
+        {
+            size_t offset;
+            int numBytes;
+            int samplePosition;
+        };
+        std::vector<juce::uint8> m_data;
+        std::vector<Event> m_events;
+        int m_lastEventTime = 0;
+    };
+
+    struct Stage
+    {
+        std::string filename;
+        py::object module;
+        Arguments arguments;
+        uint32_t hooks = 0;
+        std::vector<MidiOutput> outputs;
+        MidiOutputState outputState;
+    };
+
+    // load the stages named by the main script's 'pipeline', returns the union of their hooks, call while loading
+    uint32_t loadPipeline(const py::dict& dict, const char* filename, std::vector<Stage>& stages);
+    // run the stages on the main script's output, the last stage writes the processed midi, audio only if processAudio
+    void processPipeline(bool processAudio);
+
+    // pipeline stages (only touched while locked), the union of their hooks, and the event lists between stages
+    std::vector<Stage> m_stages;
+    std::atomic<uint32_t> m_stageHooks{ 0 };
+    std::array<MidiEvents, 2> m_stageEvents;
+
+    //
+    // Script replacement
+    //
+    // Everything derived from a script is built from the loaded module while the previous script keeps processing,
+    // then swapped in along with the module (see PythonExecutor::loadScript). Any step failing discards all of it.
+    //
+
+    struct ParameterDeclaration
+    {
+        String name;
+        float minimum = 0.0f;
+        float maximum = 1.0f;
+        double smoothingSeconds = 0.02;
+    };
+
+    struct LoadedScript
+    {
+        Arguments arguments;
+        uint32_t hooks = 0;
+        std::vector<MidiOutput> outputs;
+        std::vector<int> controlValues;
+        std::vector<Stage> stages;
+        uint32_t stageHooks = 0;
+        double budget = 1.0;
+        double controlRate = 200.0;
+        std::vector<ParameterDeclaration> parameters;
+        // parameters claimed by a different script, and their declared default, applied once committed
+        std::vector<std::pair<ScriptParameter*, float>> defaults;
+    };
+
+    // build the script's state from the loaded module, call while loading, throws on failure
+    void loadScriptState(const char* filename, LoadedScript& loaded);
+    // swap the loaded state in, leaving the replaced state in loaded, call while locked
+    void commitScriptState(LoadedScript& loaded);
+
+    // parameter pool, the number claimed by the current script, and smoothing buffers (one block per parameter)
+    std::array<Parameter, maxParameters> m_parameters;
+    int m_numParameters = 0;
+    HeapBlock<float> m_parameterBuffers;
+    int m_parameterBufferSamples = 0;
+    // 1, 2, 3, ... used to generate linear ramps with vector operations
+    HeapBlock<float> m_ramp;
+
+    // midi output of the block being processed, reserved in prepareToPlay
+    MidiBuffer m_processedMidi;
+
+    // contiguous scratch memory for hosts whose channels can't be viewed as a single strided array
+    std::tuple<std::vector<float>, std::vector<double>> m_scratch;
+
+    // processing functions defined by the current script (see Hooks)
+    std::atomic<uint32_t> m_hooks{ 0 };
+
+    // transport state of the current block as scripts see it, and as last read from the play head
+    Transport m_transport;
+    Transport m_hostTransport;
+
+    // true while the host is rendering offline (see isNonRealtime)
+    std::atomic<bool> m_offline{ false };
+
+    // trace recording resources
+    TraceRecorder m_trace;
+
+    // the block handed to the shared scheduler, if enabled
+    PythonScheduler::Job m_job;
+    void* m_jobBuffer = nullptr;
+    MidiBuffer* m_jobMidi = nullptr;
+
+    // callback budget as a fraction of the block duration (0 = unlimited), and overrun counters
+    std::atomic<double> m_budget{ 1.0 };
+    std::atomic<int> m_overruns{ 0 };
+    int m_consecutiveOverruns = 0;
+
+    // control rate scheduling (see processControlTicks), the rate is read from the script's 'control_rate' and the
+    // schedule restarts whenever a script is executed or playback is prepared
+    std::atomic<double> m_controlRate{ 200.0 };
+    std::atomic<bool> m_controlReset{ true };
+    // samples processed since the schedule restarted, up to the current block, and the next tick's index
+    int64 m_controlSamples = 0;
+    int64 m_controlTicks = 0;
+    // last value sent per output by processControl
+    std::vector<int> m_controlValues;
 
-    // previous MIDI outputs, used to implement CC pickup for devices which don't (reliably) support it
-    std::map<int, int> m_PrevMidiOutputs;
+    // state of the main script's midi output
+    MidiOutputState m_outputState;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(PythonAudioProcessor)
 };
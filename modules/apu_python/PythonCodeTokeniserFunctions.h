@@ -3,47 +3,170 @@
 // Desc: Utility functions for parsing Python tokens
 //
 
+//
+// PythonKeywords
+//
+// Perfect hash table of Python keywords, built at compile time. The hash only looks at the length and the
+// first, second and last characters, so it can be computed while an identifier is being read. The soft keywords
+// match and case are included (they're highlighted even where a script uses them as names), the soft keyword _ is
+// left out since it's far more often an ordinary name.
+//
+
+namespace PythonKeywords
+{
+    static constexpr int minLength = 2;
+    static constexpr int maxLength = 8;
+    static constexpr unsigned tableSize = 64;
+
+    static constexpr const char* keywords[] = { "False", "None", "True", "and", "as", "assert", "async", "await", "break", "case", "class",
+        "continue", "def", "del", "elif", "else", "except", "finally", "for", "from", "global", "if", "import", "in", "is", "lambda", "match",
+        "nonlocal", "not", "or", "pass", "raise", "return", "try", "while", "with", "yield" };
+
+    static constexpr unsigned hash(int length, juce_wchar first, juce_wchar second, juce_wchar last) noexcept
+    {
+        return ((unsigned)length * 2u + (unsigned)first * 4u + (unsigned)second * 11u + (unsigned)last * 9u) & (tableSize - 1);
+    }
+
+    static constexpr int length(const char* keyword) noexcept
+    {
+        int length = 0;
+        while (keyword[length] != 0)
+            ++length;
+        return length;
+    }
+
+    struct Table
+    {
+        const char* slots[tableSize];
+        bool collision;
+    };
+
+    static constexpr Table build() noexcept
+    {
+        Table table{};
+        for (auto keyword : keywords) {
+            const int keywordLength = length(keyword);
+            const unsigned slot = hash(keywordLength, keyword[0], keyword[1], keyword[keywordLength - 1]);
+            table.collision = table.collision || table.slots[slot] != nullptr;
+            table.slots[slot] = keyword;
+        }
+        return table;
+    }
+
+    static constexpr Table table = build();
+    static_assert(!table.collision, "keyword hash is no longer perfect, pick new hash multipliers");
+}
+
 struct PythonTokeniserFunctions : public CppTokeniserFunctions
 {
-    static bool isReservedKeyword(String::CharPointerType token, const int tokenLength) noexcept
+    // note: unlike C++, '@' is an operator (or decorator) rather than part of an identifier
+    static bool isIdentifierStart(const juce_wchar c) noexcept { return CharacterFunctions::isLetter(c) || c == '_'; }
+    static bool isIdentifierBody(const juce_wchar c) noexcept { return CharacterFunctions::isLetterOrDigit(c) || c == '_'; }
+
+    static bool isReservedKeyword(const char* token, const int tokenLength) noexcept
+    {
+        if (tokenLength < PythonKeywords::minLength || tokenLength > PythonKeywords::maxLength)
+            return false;
+
+        const char* keyword = PythonKeywords::table.slots[PythonKeywords::hash(tokenLength, token[0], token[1], token[tokenLength - 1])];
+        return keyword != nullptr && memcmp(keyword, token, (size_t)tokenLength) == 0 && keyword[tokenLength] == 0;
+    }
+
+    static bool isStringPrefix(const char* token, const int tokenLength) noexcept
+    {
+        // r, b, u, f and their combinations (e.g. rb, fr), in either case
+        if (tokenLength <= 0 || tokenLength > 2)
+            return false;
+
+        for (int i = 0; i < tokenLength; ++i) {
+            const char c = (char)CharacterFunctions::toLowerCase((juce_wchar)token[i]);
+            if (c != 'r' && c != 'b' && c != 'u' && c != 'f')
+                return false;
+        }
+        return true;
+    }
+
+    template <typename Iterator>
+    static void skipString(Iterator& source) noexcept
     {
-        static const char* const keywords[] = { "and", "as", "assert", "break", "class", "continue", "def", "del", "elif", "else", "except", "exec", "False",
-            "finally", "for", "from", "global", "if", "import", "in", "is", "lambda", "None", "not", "or", "pass", "print", "raise", "return", "triple", "True",
-            "try", "while", "with", "yield", nullptr };
+        const auto quote = source.nextChar();
+
+        // check for empty or triple quoted string
+        bool triple = false;
+        if (source.peekNextChar() == quote) {
+            source.skip();
+            if (source.peekNextChar() != quote)
+                return;
+            source.skip();
+            triple = true;
+        }
+
+        for (;;) {
+            const auto c = source.peekNextChar();
+
+            // only triple quoted strings span lines
+            if (c == 0 || (!triple && (c == '\n' || c == '\r')))
+                return;
 
-        for (int i = 0; keywords[i] != nullptr; ++i)
-            if (token.compare(CharPointer_ASCII(keywords[i])) == 0)
-                return true;
+            source.skip();
 
-        return false;
+            if (c == '\\') {
+                source.skip();
+            }
+            else if (c == quote) {
+                if (!triple)
+                    return;
+                if (source.peekNextChar() == quote) {
+                    source.skip();
+                    if (source.peekNextChar() == quote) {
+                        source.skip();
+                        return;
+                    }
+                }
+            }
+        }
     }
 
     template <typename Iterator>
     static int parseIdentifier(Iterator& source) noexcept
     {
+        // only enough characters to compare against the longest keyword are kept
+        char token[PythonKeywords::maxLength];
         int tokenLength = 0;
-        String::CharPointerType::CharType possibleIdentifier[100];
-        String::CharPointerType possible(possibleIdentifier);
 
         while (isIdentifierBody(source.peekNextChar())) {
             auto c = source.nextChar();
 
-            if (tokenLength < 20)
-                possible.write(c);
+            if (tokenLength < PythonKeywords::maxLength)
+                token[tokenLength] = c < 128 ? (char)c : 0;
 
             ++tokenLength;
         }
 
-        if (tokenLength > 1 && tokenLength <= 16) {
-            possible.writeNull();
-
-            if (isReservedKeyword(String::CharPointerType(possibleIdentifier), tokenLength))
-                return CPlusPlusCodeTokeniser::tokenType_keyword;
+        // string prefix, e.g. f"..." or rb'...'
+        const auto next = source.peekNextChar();
+        if ((next == '"' || next == '\'') && isStringPrefix(token, tokenLength)) {
+            skipString(source);
+            return CPlusPlusCodeTokeniser::tokenType_string;
         }
 
+        if (isReservedKeyword(token, tokenLength))
+            return CPlusPlusCodeTokeniser::tokenType_keyword;
+
         return CPlusPlusCodeTokeniser::tokenType_identifier;
     }
 
+    template <typename Iterator>
+    static int parseDecorator(Iterator& source) noexcept
+    {
+        // '@' followed by a (dotted) name
+        source.skip();
+        while (isIdentifierBody(source.peekNextChar()) || source.peekNextChar() == '.')
+            source.skip();
+
+        return CPlusPlusCodeTokeniser::tokenType_preprocessor;
+    }
+
     template <typename Iterator>
     static int readNextToken(Iterator& source)
     {
@@ -78,13 +201,49 @@ struct PythonTokeniserFunctions : public CppTokeniserFunctions
             }
 
             case '"':
-                skipQuotedString(source);
+            case '\'':
+                skipString(source);
                 return CPlusPlusCodeTokeniser::tokenType_string;
 
             case '#':
                 source.skipToEndOfLine();
                 return CPlusPlusCodeTokeniser::tokenType_comment;
 
+            case '@': {
+                auto decorator = source;
+                decorator.skip();
+                if (isIdentifierStart(decorator.peekNextChar()))
+                    return parseDecorator(source);
+
+                source.skip();
+                return CPlusPlusCodeTokeniser::tokenType_operator;
+            }
+
+            case '(':
+            case ')':
+            case '[':
+            case ']':
+            case '{':
+            case '}':
+                source.skip();
+                return CPlusPlusCodeTokeniser::tokenType_bracket;
+
+            case '+':
+            case '-':
+            case '*':
+            case '/':
+            case '%':
+            case '&':
+            case '|':
+            case '^':
+            case '~':
+            case '<':
+            case '>':
+            case '=':
+            case '!':
+                source.skip();
+                return CPlusPlusCodeTokeniser::tokenType_operator;
+
             default:
                 if (isIdentifierStart(firstChar))
                     return parseIdentifier(source);
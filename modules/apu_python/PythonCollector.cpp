@@ -0,0 +1,164 @@
+//
+// File: PythonCollector.cpp
+// Desc: Definitions for PythonCollector class
+//
+
+#include "apu_python.h"
+
+// pauses assumed for the young generations until one has been measured, full collections have to be measured by the
+// idle thread before they're run after a callback
+static const double initialExpectedMs[3] = { 0.1, 0.5, 0.0 };
+
+// a collection only runs after a callback if its expected pause is at most this fraction of the time left
+static const double budgetFraction = 0.5;
+
+// how long the idle thread waits after the last realtime callback before taking the GIL
+static const double idleSeconds = 0.25;
+
+PythonCollector& PythonCollector::getInstance()
+{
+    static PythonCollector collector;
+    return collector;
+}
+
+PythonCollector::~PythonCollector()
+{
+    m_quit = true;
+    if (m_thread.joinable())
+        m_thread.join();
+    // the interpreter is gone by now
+    m_collect.release();
+    m_getCount.release();
+}
+
+void PythonCollector::start()
+{
+    if (m_thread.joinable())
+        return;
+
+    setAutomatic(false);
+
+    py::module_ gc = py::module_::import("gc");
+    m_collect = gc.attr("collect");
+    m_getCount = gc.attr("get_count");
+    const py::tuple thresholds = gc.attr("get_threshold")();
+    for (size_t i = 0; i < 3; ++i) {
+        m_thresholds[i] = thresholds[i].cast<int>();
+        m_expectedMs[i] = initialExpectedMs[i];
+    }
+
+    m_thread = std::thread([this]() { run(); });
+}
+
+PythonCollector::Stats PythonCollector::getStats()
+{
+    std::lock_guard lock(m_mutex);
+    Stats stats = m_stats;
+    stats.pending = m_pending;
+    return stats;
+}
+
+void PythonCollector::setAutomatic(bool automatic)
+{
+#if PY_VERSION_HEX >= 0x030A0000
+    if (automatic)
+        PyGC_Enable();
+    else
+        PyGC_Disable();
+#else
+    py::module_::import("gc").attr(automatic ? "enable" : "disable")();
+#endif
+}
+
+bool PythonCollector::collect(double budgetSeconds)
+{
+    if (!m_getCount)
+        return false;
+
+    try {
+        const int generation = getDueGeneration(budgetSeconds > 0.0 ? 1000.0 * budgetSeconds * budgetFraction : -1.0);
+        if (generation < 0)
+            return false;
+        collectGeneration(generation, false);
+        return true;
+    }
+    catch (...) {
+        return false;
+    }
+}
+
+void PythonCollector::run()
+{
+    static const uint32_t polling_interval = 50;
+
+    Thread::setCurrentThreadPriority(0);
+
+    while (!m_quit.load()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(polling_interval));
+
+        // stay off the GIL while realtime callbacks are running, they collect what fits in their own budgets
+        if (Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - m_lastRealtime.load()) < idleSeconds)
+            continue;
+
+        // nor while any executor is in the middle of a block (the lock is only tested, collecting doesn't hold it)
+        {
+            std::unique_lock lock(PythonExecutor::g_mutex, std::try_to_lock);
+            if (!lock.owns_lock())
+                continue;
+        }
+
+        PyGILState_STATE state = PyGILState_Ensure();
+        try {
+            // anything due, including collections whose pause hasn't been measured yet
+            const int generation = getDueGeneration(-1.0);
+            if (generation >= 0)
+                collectGeneration(generation, true);
+        }
+        catch (...) {
+        }
+        PyGILState_Release(state);
+    }
+}
+
+int PythonCollector::getDueGeneration(double limitMs)
+{
+    // Python's own schedule: a generation is collected once its count passes its threshold, where generation 0
+    // counts allocations and older generations count collections of the next younger one
+    const py::tuple counts = m_getCount();
+    int count[3];
+    for (size_t i = 0; i < 3; ++i)
+        count[i] = counts[i].cast<int>();
+
+    m_pending = count[0];
+
+    // collecting a generation also collects the younger ones, so a younger generation stands in for an older due
+    // one which doesn't fit
+    auto fits = [this, limitMs](int generation) { return limitMs < 0.0 || (m_expectedMs[generation] > 0.0 && m_expectedMs[generation] <= limitMs); };
+    for (auto i = 2; i >= 0; --i) {
+        if (m_thresholds[i] <= 0 || count[i] <= m_thresholds[i])
+            continue;
+        for (auto j = i; j >= 0; --j)
+            if (fits(j))
+                return j;
+        return -1;
+    }
+
+    return -1;
+}
+
+void PythonCollector::collectGeneration(int generation, bool idle)
+{
+    const auto start = Time::getHighResolutionTicks();
+    const auto collected = m_collect(generation).cast<int64>();
+    const double pauseMs = 1000.0 * Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - start);
+
+    // expect the longer of the running average and the latest pause
+    m_expectedMs[generation] = m_expectedMs[generation] > 0.0 ? jmax(pauseMs, 0.75 * m_expectedMs[generation] + 0.25 * pauseMs) : pauseMs;
+
+    std::lock_guard lock(m_mutex);
+    ++m_stats.collections[generation];
+    m_stats.collected += collected;
+    m_stats.totalPauseMs += pauseMs;
+    m_stats.maxPauseMs = jmax(m_stats.maxPauseMs, pauseMs);
+    m_stats.idleCollections += idle ? 1 : 0;
+}
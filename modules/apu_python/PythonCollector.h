@@ -0,0 +1,88 @@
+//
+// File: PythonCollector.h
+// Desc: Declarations for PythonCollector class
+//
+
+#ifndef PYTHON_COLLECTOR_H
+#define PYTHON_COLLECTOR_H
+
+#include "apu_python.h"
+
+#include <mutex>
+#include <thread>
+#include <atomic>
+
+//
+// PythonCollector
+//
+// Takes Python's cyclic garbage collection out of the way of the audio thread. Automatic collection is disabled for
+// the whole interpreter and Python's generational schedule is run by hand instead, at points where nobody waits on
+// it: right after each callback, the thread which ran it collects the oldest due generation whose expected pause
+// fits in what's left of its own budget (see PythonExecutor::endCallback). Collections which don't fit any block,
+// typically the first full collection, are left to a low priority thread which only takes the GIL once no realtime
+// callback has run for a while. Scripts can opt back into automatic collection during their own callbacks.
+//
+
+class PythonCollector
+{
+public:
+    struct Stats
+    {
+        int64 collections[3] = {};
+        int64 collected = 0;
+        double totalPauseMs = 0.0;
+        double maxPauseMs = 0.0;
+        // allocations since the last collection (gc.get_count()[0])
+        int64 pending = 0;
+        // collections run by the idle thread rather than after a callback
+        int64 idleCollections = 0;
+    };
+
+    static PythonCollector& getInstance();
+
+    // take over collection, call once with the GIL held after the interpreter is created
+    void start();
+
+    Stats getStats();
+
+    // switch automatic collection on/off, call with the GIL held
+    static void setAutomatic(bool automatic);
+
+    // collect the oldest due generation expected to finish within the given time (0 = unlimited), call with the GIL
+    // held after a callback, returns false if nothing was due or nothing fitted
+    bool collect(double budgetSeconds);
+
+    // note a realtime callback, the idle thread stays off the GIL for a while after each one
+    void notifyRealtime() { m_lastRealtime = Time::getHighResolutionTicks(); }
+
+private:
+    PythonCollector() {}
+    ~PythonCollector();
+
+    void run();
+    // oldest generation due under Python's schedule whose expected pause is measured and within the limit (ms, a
+    // negative limit accepts any), or -1
+    int getDueGeneration(double limitMs);
+    void collectGeneration(int generation, bool idle);
+
+    // cached gc functions and thresholds (GIL)
+    py::object m_collect;
+    py::object m_getCount;
+    int m_thresholds[3] = {};
+    // expected pause per generation in ms, a running average of measured pauses, 0 until measured (GIL)
+    double m_expectedMs[3] = {};
+
+    // collection statistics
+    std::mutex m_mutex;
+    Stats m_stats;
+
+    // collector thread resources
+    std::thread m_thread;
+    std::atomic<bool> m_quit{ false };
+    std::atomic<int64> m_lastRealtime{ 0 };
+    std::atomic<int64> m_pending{ 0 };
+
+    JUCE_DECLARE_NON_COPYABLE(PythonCollector)
+};
+
+#endif /* PYTHON_COLLECTOR_H */
@@ -10,6 +10,7 @@ PythonEditor::PythonEditor(PythonExecutor& pythonExecutor, FilenameComponentList
     m_menu(this),
     m_editor(m_document, &m_tokeniser),
     m_fileChooser("File", {}, true, false, false, "*.py", {}, "Choose a Python file to open it in the editor"),
+    m_profiler(pythonExecutor),
     m_monitorQuit(true)
 {
     // initialize command manager
@@ -33,9 +34,20 @@ PythonEditor::PythonEditor(PythonExecutor& pythonExecutor, FilenameComponentList
     Component::addAndMakeVisible(&m_menu);
     Component::addAndMakeVisible(m_fileChooser);
     Component::addAndMakeVisible(m_editor);
+    Component::addAndMakeVisible(m_outputView);
+    Component::addChildComponent(m_profileView);
     Component::addKeyListener(m_commandManager.getKeyMappings());
     Component::setSize(640, 480);
 
+    // initialize output and profile views
+    for (auto view : { &m_outputView, &m_profileView }) {
+        view->setMultiLine(true);
+        view->setReadOnly(true);
+        view->setScrollbarsShown(true);
+        view->setFont(Font(Font::getDefaultMonospacedFontName(), 13.0f, Font::plain));
+    }
+    startTimer(250);
+
     // initialize default look and feel
     PythonEditor::lookAndFeelChanged();
 }
@@ -44,6 +56,7 @@ PythonEditor::~PythonEditor()
 {
     m_fileChooser.removeListener(this);
     stopMonitoring();
+    m_profiler.stop();
 }
 
 void PythonEditor::paint(Graphics& graphics)
@@ -60,11 +73,15 @@ void PythonEditor::resized()
     juce::Rectangle<int> body_bounds = local_bounds.reduced(8);
     juce::Rectangle<int> chooser_bounds = body_bounds.removeFromTop(25);
     juce::Rectangle<int> editor_bounds = body_bounds.withTrimmedTop(8);
+    juce::Rectangle<int> output_bounds = editor_bounds.removeFromBottom(editor_bounds.getHeight() / 4).withTrimmedTop(8);
+    juce::Rectangle<int> profile_bounds = m_profileView.isVisible() ? output_bounds.removeFromRight(output_bounds.getWidth() / 2).withTrimmedLeft(8) : juce::Rectangle<int>();
 
     // apply bounds
     m_menu.setBounds(menu_bounds);
     m_fileChooser.setBounds(chooser_bounds);
     m_editor.setBounds(editor_bounds);
+    m_outputView.setBounds(output_bounds);
+    m_profileView.setBounds(profile_bounds);
 }
 
 void PythonEditor::lookAndFeelChanged()
@@ -144,6 +161,9 @@ void PythonEditor::startMonitoring()
         static const uint32_t yield_interval = 25;
         static const uint32_t polling_interval = 2000;
 
+        // modification timestamps of helper modules the script depends on
+        std::map<std::string, std::filesystem::file_time_type> dependencies;
+
         // poll until signal is sent to quit
         auto previous = std::chrono::steady_clock::now();
         while (!m_monitorQuit.load()) {
@@ -164,6 +184,20 @@ void PythonEditor::startMonitoring()
                             m_lastModified = last_modified;
                         }
                     }
+                    // if a helper module has been modified, asynchronously re-execute the script so it gets reloaded
+                    bool changed = false;
+                    for (auto& dependency : m_pythonExecutor.getDependencies()) {
+                        std::error_code error;
+                        auto last_modified = std::filesystem::last_write_time(dependency, error);
+                        if (error)
+                            continue;
+                        auto found = dependencies.find(dependency);
+                        if (found != dependencies.end() && found->second != last_modified)
+                            changed = true;
+                        dependencies[dependency] = last_modified;
+                    }
+                    if (changed)
+                        MessageManager::getInstanceWithoutCreating()->callAsync([this]() { codeDocumentTextChanged(); });
                     // reset polling interval
                     previous = current;
                 }
@@ -184,13 +218,23 @@ PopupMenu PythonEditor::getMenuForIndex(int menuIndex, const String& menuName)
         menu.addCommandItem(&m_commandManager, CommandIDs::MenuItemFileSave);
         menu.addCommandItem(&m_commandManager, CommandIDs::MenuItemFileSaveAs);
     }
+    else if (menuIndex == 1) {
+        menu.addCommandItem(&m_commandManager, CommandIDs::MenuItemProfileToggle);
+        menu.addCommandItem(&m_commandManager, CommandIDs::MenuItemProfileReset);
+        menu.addCommandItem(&m_commandManager, CommandIDs::MenuItemProfileExport);
+    }
+    else if (menuIndex == 2) {
+        menu.addCommandItem(&m_commandManager, CommandIDs::MenuItemLogClear);
+        menu.addCommandItem(&m_commandManager, CommandIDs::MenuItemLogToFile);
+    }
 
     return menu;
 }
 
 void PythonEditor::getAllCommands(Array<CommandID>& c)
 {
-    Array<CommandID> commands{ MenuItemFileSave, MenuItemFileSaveAs };
+    Array<CommandID> commands{ MenuItemFileSave, MenuItemFileSaveAs, MenuItemProfileToggle, MenuItemProfileReset, MenuItemProfileExport, MenuItemLogClear,
+        MenuItemLogToFile };
 
     c.addArray(commands);
 }
@@ -206,6 +250,23 @@ void PythonEditor::getCommandInfo(CommandID commandID, ApplicationCommandInfo& r
         case CommandIDs::MenuItemFileSaveAs:
             result.setInfo("Save As", "Saves the current file, prompting for filename", "Menu", 0);
             break;
+        case CommandIDs::MenuItemProfileToggle:
+            result.setInfo("Sample Profiler", "Samples the script's processing functions and shows where time is spent", "Menu", 0);
+            result.setTicked(m_profiler.isRunning());
+            break;
+        case CommandIDs::MenuItemProfileReset:
+            result.setInfo("Reset", "Discards all samples collected so far", "Menu", 0);
+            break;
+        case CommandIDs::MenuItemProfileExport:
+            result.setInfo("Export Collapsed Stacks", "Saves the samples in collapsed stack format, prompting for filename", "Menu", 0);
+            break;
+        case CommandIDs::MenuItemLogClear:
+            result.setInfo("Clear", "Clears the script output", "Menu", 0);
+            break;
+        case CommandIDs::MenuItemLogToFile:
+            result.setInfo("Log to File", "Also appends script output to a file, prompting for filename", "Menu", 0);
+            result.setTicked(m_pythonExecutor.getLog().getFile() != File());
+            break;
     }
 }
 
@@ -237,6 +298,43 @@ bool PythonEditor::perform(const InvocationInfo& info)
         case CommandIDs::MenuItemFileSaveAs:
             saveAs();
             break;
+        case CommandIDs::MenuItemProfileToggle:
+            if (m_profiler.isRunning())
+                m_profiler.stop();
+            else
+                m_profiler.start();
+            m_profileView.setVisible(m_profiler.isRunning());
+            timerCallback();
+            resized();
+            menuItemsChanged();
+            break;
+        case CommandIDs::MenuItemProfileReset:
+            m_profiler.reset();
+            timerCallback();
+            break;
+        case CommandIDs::MenuItemProfileExport: {
+            FileChooser fc(TRANS("Choose a file to export to"), File(), "*.txt");
+            if (fc.browseForFileToSave(true))
+                m_profiler.exportCollapsed(fc.getResult());
+            break;
+        }
+        case CommandIDs::MenuItemLogClear:
+            m_pythonExecutor.getLog().clear();
+            timerCallback();
+            break;
+        case CommandIDs::MenuItemLogToFile: {
+            auto& log = m_pythonExecutor.getLog();
+            if (log.getFile() != File()) {
+                log.setFile(File());
+            }
+            else {
+                FileChooser fc(TRANS("Choose a file to log to"), File(), "*.log");
+                if (fc.browseForFileToSave(false))
+                    log.setFile(fc.getResult());
+            }
+            menuItemsChanged();
+            break;
+        }
         default:
             return false;
     }
@@ -270,3 +368,16 @@ void PythonEditor::codeDocumentTextChanged()
     // execute python code
     m_pythonExecutor.execute(getFilename().c_str(), script.c_str());
 }
+
+void PythonEditor::timerCallback()
+{
+    // only touch the output view when there's something new, keeping it scrolled to the end
+    String output;
+    if (m_pythonExecutor.getLog().getHistory(output, m_outputVersion)) {
+        m_outputView.setText(output, false);
+        m_outputView.moveCaretToEnd();
+    }
+
+    if (m_profiler.isRunning())
+        m_profileView.setText(m_profiler.getReport(), false);
+}
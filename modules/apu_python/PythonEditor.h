@@ -19,13 +19,19 @@
 // to define Python function(s) for external code to call.
 //
 
-class PythonEditor : public Component, private MenuBarModel, private ApplicationCommandTarget, private FilenameComponentListener, private CodeDocument::Listener
+class PythonEditor : public Component, private MenuBarModel, private ApplicationCommandTarget, private FilenameComponentListener, private CodeDocument::Listener,
+    private Timer
 {
 public:
     enum CommandIDs
     {
         MenuItemFileSave = 1,
-        MenuItemFileSaveAs
+        MenuItemFileSaveAs,
+        MenuItemProfileToggle,
+        MenuItemProfileReset,
+        MenuItemProfileExport,
+        MenuItemLogClear,
+        MenuItemLogToFile
     };
 
     PythonEditor(PythonExecutor& pythonExecutor, FilenameComponentListener* listener = nullptr, std::string filename = "");
@@ -50,7 +56,7 @@ private:
     void startMonitoring();
 
     // MenuBarModel interface implementation
-    StringArray getMenuBarNames() override { return { "File" }; }
+    StringArray getMenuBarNames() override { return { "File", "Profile", "Log" }; }
     PopupMenu getMenuForIndex(int menuIndex, const String& menuName) override;
     void menuItemSelected(int /*menuItemID*/, int /*topLevelMenuIndex*/) override {}
 
@@ -68,6 +74,9 @@ private:
     void codeDocumentTextDeleted(int startIndex, int endIndex) override { codeDocumentTextChanged(); }
     void codeDocumentTextChanged();
 
+    // Timer interface implementation (refreshes the output and profile views)
+    void timerCallback() override;
+
     // python executor
     PythonExecutor& m_pythonExecutor;
 
@@ -81,6 +90,14 @@ private:
     CodeEditorComponent m_editor;
     FilenameComponent m_fileChooser;
 
+    // script output resources
+    TextEditor m_outputView;
+    int64 m_outputVersion = -1;
+
+    // profiler resources
+    PythonProfiler m_profiler;
+    TextEditor m_profileView;
+
     // python source monitor resources
     std::filesystem::file_time_type m_lastModified;
     std::thread m_monitor;
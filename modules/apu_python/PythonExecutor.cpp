@@ -9,15 +9,24 @@
 #endif
 
 // global resources
-PythonExecutor* g_executor = nullptr;
 std::unique_ptr<py::scoped_interpreter> PythonExecutor::g_interpreter;
-std::mutex PythonExecutor::g_mutex;
+std::shared_mutex PythonExecutor::g_mutex;
 PyThreadState* PythonExecutor::g_mainState = nullptr;
 PyInterpreterState* PythonExecutor::g_mainInterpreter = nullptr;
+std::mutex PythonExecutor::g_loadMutex;
+double PythonExecutor::g_switchInterval = 0.005;
+std::set<std::string> PythonExecutor::g_importPaths;
+std::map<std::string, PythonExecutor::TrackedModule> PythonExecutor::g_trackedModules;
 
 // thread local resources
+static thread_local PythonExecutor* g_executor = nullptr;
 static thread_local PyThreadState* thread_state = nullptr;
 static thread_local PyThreadState* main_state = nullptr;
+static thread_local bool exclusive_lock = false;
+static thread_local bool loading_script = false;
+
+// switch interval while a script loads, so callbacks waiting for the GIL get it well within a block
+static const double loadSwitchInterval = 0.0005;
 
 PythonExecutor::PythonExecutor()
 {
@@ -44,6 +53,12 @@ PythonExecutor::PythonExecutor()
             // python doesn't let us create a new state for the main thread, otherwise
             // things break with very little indication as to why
             thread_state = g_mainState;
+            // track helper module imports
+            installImportHook();
+            // capture script output
+            installOutputRedirect();
+            // collect garbage where no audio thread waits on it
+            PythonCollector::getInstance().start();
         }
 
         if (first)
@@ -52,67 +67,496 @@ PythonExecutor::PythonExecutor()
 
     // initialize the module context
     initContext();
+
+    // enforce callback deadlines
+    PythonWatchdog::getInstance().add(this);
 }
 
 PythonExecutor::~PythonExecutor()
 {
+    PythonWatchdog::getInstance().remove(this);
+    PythonAssets::getInstance().release(this);
+
     std::lock_guard lock(g_mutex);
     PyThreadState_Swap(g_mainState);
 }
 
 void PythonExecutor::execute(const char* filename, const char* script)
 {
-    // reset the module context
-    initContext();
+    PythonExecutor::lockLoad();
+    const bool loaded = loadScript(filename, script);
+    PythonExecutor::unlockLoad();
 
-    PythonExecutor::lock();
+    if (loaded) {
+        PythonExecutor::lock();
+        commitScript();
+        PythonExecutor::unlock();
+    }
+
+    PythonExecutor::lockLoad();
+    discardScript();
+    PythonExecutor::unlockLoad();
+}
+
+bool PythonExecutor::loadScript(const char* filename, const char* script)
+{
+    // state carried over from the running script
+    py::object state;
+    try {
+        py::dict dict = m_module.attr("__dict__");
+        if (dict.contains("exportState"))
+            state = dict["exportState"]();
+    }
+    catch (const std::exception& e) {
+        m_log.writeLine(PythonLog::LevelError, e.what());
+    }
+    catch (...) {
+    }
 
+    bool succeeded = false;
     try {
+        m_loaded = Script();
+        m_loaded.module = createContext();
         // determine the script's path
         std::string scriptPath = filename;
         scriptPath = scriptPath.substr(0, scriptPath.find_last_of("\\/"));
+        m_loaded.directory = scriptPath;
         // add the script's directory to sys.path so module imports will work
-        py::module sys = py::module::import("sys");
-        sys.attr("path").attr("append")(scriptPath.c_str());
-        // execute the script with our module context
-        py::dict dict = m_module.attr("__dict__");
+        addImportPath(scriptPath);
+        // reload any helper modules which have changed since they were imported, holding off the running script
+        {
+            PyThreadState* threadState = PyEval_SaveThread();
+            std::unique_lock exclusive(g_mutex);
+            PyEval_RestoreThread(threadState);
+            reloadDependencies();
+        }
+        // execute the script with its module context
+        py::dict dict = m_loaded.module.attr("__dict__");
         py::exec(script, dict, dict);
+        // optional opt-out of scheduled garbage collection
+        m_loaded.automaticCollection = dict.contains("automatic_gc") && py::bool_(py::object(dict["automatic_gc"]));
+        // hand over the previous script's state
+        if (state && dict.contains("importState"))
+            dict["importState"](state);
+        succeeded = true;
+    }
+    catch (const std::exception& e) {
+        m_log.writeLine(PythonLog::LevelError, e.what());
     }
     catch (...) {
     }
 
-    PythonExecutor::unlock();
+    if (!succeeded) {
+        m_loaded = Script();
+        m_log.writeLine(PythonLog::LevelError, "script failed, the previous script (if any) stays active");
+    }
+
+    return succeeded;
 }
 
-void PythonExecutor::lock()
+void PythonExecutor::commitScript()
 {
-    g_mutex.lock();
-    g_executor = this;
+    // the replaced script is left in m_loaded, to be released outside the lock
+    std::swap(m_module, m_loaded.module);
+    std::swap(m_scriptDirectory, m_loaded.directory);
+    std::swap(m_imports, m_loaded.imports);
+    std::swap(m_files, m_loaded.files);
+    std::swap(m_automaticCollection, m_loaded.automaticCollection);
+
+    // update the helper module files this script depends on
+    updateDependencies();
+}
+
+void PythonExecutor::discardScript()
+{
+    m_loaded = Script();
+}
+
+std::vector<std::string> PythonExecutor::getDependencies()
+{
+    std::lock_guard lock(m_dependencyMutex);
+    return m_dependencies;
+}
+
+PythonExecutor* PythonExecutor::getCurrent() { return g_executor; }
 
+const std::string& PythonExecutor::getScriptDirectory() const
+{
+    return loading_script && g_executor == this ? m_loaded.directory : m_scriptDirectory;
+}
+
+void PythonExecutor::restoreThread()
+{
     if (thread_state == nullptr) {
-        thread_state = PyThreadState_New(g_mainInterpreter);
+        // register the thread, taking a pooled state
+        thread_state = PythonThreadStatePool::getInstance().acquire(g_mainInterpreter);
         PyThreadState_Swap(thread_state);
     }
 
     PyEval_RestoreThread(thread_state);
 }
 
+void PythonExecutor::lock(bool exclusive)
+{
+    if (exclusive)
+        g_mutex.lock();
+    else
+        g_mutex.lock_shared();
+    exclusive_lock = exclusive;
+    g_executor = this;
+    restoreThread();
+}
+
 void PythonExecutor::unlock()
 {
     thread_state = PyEval_SaveThread();
 
     g_executor = nullptr;
-    g_mutex.unlock();
+    if (exclusive_lock)
+        g_mutex.unlock();
+    else
+        g_mutex.unlock_shared();
+}
+
+void PythonExecutor::lockLoad()
+{
+    g_loadMutex.lock();
+    loading_script = true;
+    g_executor = this;
+    restoreThread();
+
+    try {
+        py::module_ sys = py::module_::import("sys");
+        g_switchInterval = sys.attr("getswitchinterval")().cast<double>();
+        sys.attr("setswitchinterval")(loadSwitchInterval);
+    }
+    catch (...) {
+    }
+}
+
+void PythonExecutor::unlockLoad()
+{
+    try {
+        py::module_::import("sys").attr("setswitchinterval")(g_switchInterval);
+    }
+    catch (...) {
+    }
+
+    thread_state = PyEval_SaveThread();
+    g_executor = nullptr;
+    loading_script = false;
+    g_loadMutex.unlock();
+}
+
+void PythonExecutor::beginCallback(double budgetSeconds)
+{
+    beginCallbackUntil(budgetSeconds > 0.0 ? Time::getHighResolutionTicks() + Time::secondsToHighResolutionTicks(budgetSeconds) : 0);
+}
+
+void PythonExecutor::beginCallbackUntil(int64 deadline)
+{
+    m_callbackThread = PyThread_get_thread_ident();
+    m_callbackState = PyThreadState_Get();
+    m_callbackInterrupted = false;
+    m_callbackDeadline = deadline;
+    m_callbackActive = true;
+
+    if (m_callbackDeadline != 0) {
+        PythonWatchdog::getInstance().arm(m_callbackDeadline);
+        PythonCollector::getInstance().notifyRealtime();
+    }
+
+    if (m_automaticCollection)
+        PythonCollector::setAutomatic(true);
+
+    // samples are taken by the callback thread itself (see PythonProfiler)
+    m_profiling = m_profiler.load() != nullptr;
+    if (m_profiling)
+        PyEval_SetTrace(&PythonProfiler::trace, nullptr);
+}
+
+bool PythonExecutor::endCallback()
+{
+    // nothing to end if the block failed before its callbacks began, in particular no time to collect garbage in
+    if (!m_callbackActive.load())
+        return false;
+
+    const auto deadline = m_callbackDeadline.load();
+    m_callbackActive = false;
+    m_callbackDeadline = 0;
+
+    if (m_automaticCollection)
+        PythonCollector::setAutomatic(false);
+
+    if (m_profiling) {
+        PyEval_SetTrace(nullptr, nullptr);
+        m_profiling = false;
+    }
+
+    if (!m_callbackInterrupted) {
+        // collect garbage in what's left of the budget, so no other thread has to take the GIL for it
+        const auto now = Time::getHighResolutionTicks();
+        if (!m_automaticCollection && (deadline == 0 || now < deadline))
+            PythonCollector::getInstance().collect(deadline == 0 ? 0.0 : Time::highResolutionTicksToSeconds(deadline - now));
+        if (deadline != 0)
+            PythonCollector::getInstance().notifyRealtime();
+        return false;
+    }
+
+    // discard the exception in case it hasn't been delivered yet
+    PyThreadState_SetAsyncExc(m_callbackThread, nullptr);
+    m_callbackInterrupted = false;
+    return true;
+}
+
+bool PythonExecutor::isCallbackExpired(int64 now) const
+{
+    const auto deadline = m_callbackDeadline.load();
+    return deadline != 0 && now >= deadline && !m_callbackInterrupted;
+}
+
+void PythonExecutor::interrupt(int64 now)
+{
+    // the watchdog holds the GIL, and endCallback is only called while locked, so the callback can't finish
+    // between this check and raising the exception
+    if (!isCallbackExpired(now))
+        return;
+
+    m_callbackInterrupted = true;
+    PyThreadState_SetAsyncExc(m_callbackThread, PyExc_TimeoutError);
 }
 
 void PythonExecutor::initContext()
 {
     PythonExecutor::lock();
-    m_module = py::module_::create_extension_module("PythonExecutor", nullptr, new PyModuleDef());
-    m_module.doc() = "apu module";
+    m_module = createContext();
     PythonExecutor::unlock();
 }
 
+py::module_ PythonExecutor::createContext()
+{
+    // pybind11 expects a statically allocated definition, it's re-initialized for every module created
+    static PyModuleDef definition;
+    py::module_ module = py::module_::create_extension_module("PythonExecutor", nullptr, &definition);
+    module.doc() = "apu module";
+    prepareContext(module.attr("__dict__"));
+    return module;
+}
+
+void PythonExecutor::installImportHook()
+{
+    py::module builtins = py::module::import("builtins");
+    py::object original = builtins.attr("__import__");
+
+    // wrap __import__ so dependencies can be recorded after each successful import
+    builtins.attr("__import__") = py::cpp_function(
+        [original](py::object name, py::object globals, py::object locals, py::object fromlist, int level) {
+            py::object module = original(name, globals, locals, fromlist, level);
+            try {
+                recordImport(name, globals, fromlist, level);
+            }
+            catch (...) {
+            }
+            return module;
+        },
+        py::arg("name"), py::arg("globals") = py::none(), py::arg("locals") = py::none(), py::arg("fromlist") = py::tuple(), py::arg("level") = 0);
+}
+
+void PythonExecutor::installOutputRedirect()
+{
+    // text written by a thread which has an executor locked goes to that executor's log
+    py::dict scope;
+    scope["write"] = py::cpp_function([](int level, py::str text) {
+        const std::string str = text;
+        if (g_executor)
+            g_executor->m_log.write((PythonLog::Level)level, str.data(), str.size());
+        else
+            fwrite(str.data(), 1, str.size(), level == PythonLog::LevelError ? stderr : stdout);
+    });
+    scope["output"] = py::int_((int)PythonLog::LevelOutput);
+    scope["error"] = py::int_((int)PythonLog::LevelError);
+
+    py::exec(R"(
+import sys
+
+class LogStream:
+    def __init__(self, level):
+        self.level = level
+    def write(self, text):
+        write(self.level, text)
+        return len(text)
+    def flush(self):
+        pass
+
+sys.stdout = LogStream(output)
+sys.stderr = LogStream(error)
+)",
+        scope);
+}
+
+void PythonExecutor::recordImport(py::handle name, py::handle globals, py::handle fromlist, int level)
+{
+    if (!globals || !PyDict_Check(globals.ptr()))
+        return;
+
+    py::dict scope = py::reinterpret_borrow<py::dict>(globals);
+
+    // determine who is importing: either a script (the running one, or one being loaded on this thread, including
+    // its pipeline stages), or a tracked helper module
+    std::set<std::string>* imports = nullptr;
+    if (g_executor && loading_script && scope.contains("__name__") && py::str(scope["__name__"]).cast<std::string>() == "PythonExecutor") {
+        imports = &g_executor->m_loaded.imports;
+    }
+    else if (g_executor && globals.ptr() == PyModule_GetDict(g_executor->m_module.ptr())) {
+        imports = &g_executor->m_imports;
+    }
+    else if (scope.contains("__name__")) {
+        const std::string importer = py::str(scope["__name__"]);
+        if (trackModule(importer))
+            imports = &g_trackedModules[importer].imports;
+    }
+
+    if (imports == nullptr)
+        return;
+
+    // resolve relative imports against the importer's package
+    std::string resolved = py::str(name);
+    if (level > 0) {
+        if (!scope.contains("__package__") || scope["__package__"].is_none())
+            return;
+        std::string package = py::str(scope["__package__"]);
+        for (int i = 1; i < level; ++i) {
+            const auto offset = package.find_last_of('.');
+            if (offset == std::string::npos)
+                return;
+            package.resize(offset);
+        }
+        resolved = resolved.empty() ? package : package + "." + resolved;
+    }
+
+    // record the imported module, along with any submodules pulled in through the from-list
+    if (trackModule(resolved))
+        imports->insert(resolved);
+    if (fromlist && !fromlist.is_none()) {
+        for (auto item : fromlist) {
+            const std::string submodule = resolved + "." + std::string(py::str(item));
+            if (trackModule(submodule))
+                imports->insert(submodule);
+        }
+    }
+}
+
+bool PythonExecutor::trackModule(const std::string& name)
+{
+    if (g_trackedModules.find(name) != g_trackedModules.end())
+        return true;
+
+    // note: sys.modules is read directly, going through the import system would recurse into our hook
+    PyObject* module = PyDict_GetItemString(PyImport_GetModuleDict(), name.c_str());
+    if (module == nullptr || !PyObject_HasAttrString(module, "__file__"))
+        return false;
+
+    py::object file = py::handle(module).attr("__file__");
+    if (!py::isinstance<py::str>(file))
+        return false;
+
+    // only modules living in one of the script directories are tracked
+    const std::string path = file.cast<std::string>();
+    for (auto& importPath : g_importPaths) {
+        // the directory must be followed by a separator, so /foo/scripts2 isn't under /foo/scripts
+        if (path.size() > importPath.size() && path.compare(0, importPath.size(), importPath) == 0
+            && (path[importPath.size()] == '/' || path[importPath.size()] == '\\')) {
+            std::error_code error;
+            TrackedModule& tracked = g_trackedModules[name];
+            tracked.file = path;
+            tracked.modified = std::filesystem::last_write_time(path, error);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void PythonExecutor::addImportPath(const std::string& path)
+{
+    if (path.empty() || !g_importPaths.insert(path).second)
+        return;
+
+    py::list sysPath = py::module::import("sys").attr("path");
+    if (!sysPath.attr("__contains__")(path).cast<bool>())
+        sysPath.append(path);
+}
+
+void PythonExecutor::reloadDependencies()
+{
+    py::object reload = py::module::import("importlib").attr("reload");
+
+    // reload changed modules, dependencies first, then every tracked module which imports them
+    std::map<std::string, bool> visited;
+    std::function<bool(const std::string&)> refresh = [&](const std::string& name) -> bool {
+        auto found = visited.find(name);
+        if (found != visited.end())
+            return found->second;
+        visited[name] = false;
+
+        auto tracked = g_trackedModules.find(name);
+        if (tracked == g_trackedModules.end())
+            return false;
+
+        bool changed = false;
+        const std::set<std::string> imports = tracked->second.imports;
+        for (auto& import : imports)
+            changed = refresh(import) || changed;
+
+        std::error_code error;
+        const auto modified = std::filesystem::last_write_time(tracked->second.file, error);
+        changed = changed || (!error && modified != tracked->second.modified);
+
+        PyObject* module = PyDict_GetItemString(PyImport_GetModuleDict(), name.c_str());
+        if (changed && module != nullptr) {
+            // imports are recorded again while the module re-executes
+            tracked->second.imports.clear();
+            tracked->second.modified = modified;
+            try {
+                reload(py::handle(module));
+            }
+            catch (...) {
+            }
+        }
+
+        visited[name] = changed;
+        return changed;
+    };
+
+    // only the executing script's dependency chain, other scripts reload their own helpers when executed
+    const std::set<std::string> imports = m_imports;
+    for (auto& name : imports)
+        refresh(name);
+}
+
+void PythonExecutor::updateDependencies()
+{
+    std::set<std::string> visited;
+    std::set<std::string> files(m_files.begin(), m_files.end());
+
+    std::function<void(const std::string&)> collect = [&](const std::string& name) {
+        if (!visited.insert(name).second)
+            return;
+        auto tracked = g_trackedModules.find(name);
+        if (tracked == g_trackedModules.end())
+            return;
+        files.insert(tracked->second.file);
+        for (auto& import : tracked->second.imports)
+            collect(import);
+    };
+
+    for (auto& import : m_imports)
+        collect(import);
+
+    std::lock_guard lock(m_dependencyMutex);
+    m_dependencies.assign(files.begin(), files.end());
+}
+
 #ifdef _WIN32
 #include <windows.h>
 static void dummy() {}
@@ -14,7 +14,17 @@
 namespace py = pybind11;
 
 #include <mutex>
+#include <shared_mutex>
 #include <thread>
+#include <atomic>
+#include <set>
+#include <map>
+#include <vector>
+#include <string>
+#include <filesystem>
+#include <functional>
+
+class PythonProfiler;
 
 //
 // PythonExecutor
@@ -32,13 +42,83 @@ public:
     virtual void execute(const char* filename, const char* script);
 
     // enter/exit thread interpreter
-    void lock();
+    //
+    // An exclusive lock holds the global reader/writer lock exclusively for the duration, so no other executor can
+    // run in between GIL hand-overs. A shared lock (offline rendering) holds it shared and is otherwise serialized
+    // by the GIL alone, which lets other shared holders make progress while native code (e.g. numpy) runs with the
+    // GIL released, but still excludes exclusive holders such as execute() replacing the script.
+    void lock(bool exclusive = true);
     void unlock();
 
     // bind variable to module context
     void bind(const char* name, py::object obj) { m_module.attr("__dict__")[name] = obj; }
     py::module_& getModule() { return m_module; }
 
+    // source files of helper modules the current script depends on
+    std::vector<std::string> getDependencies();
+    // directory of the running script, or of the script being loaded when called from the loading thread
+    const std::string& getScriptDirectory() const;
+
+    // script output and errors
+    PythonLog& getLog() { return m_log; }
+    // executor locked by the calling thread, if any
+    static PythonExecutor* getCurrent();
+
+    // bracket script callbacks which must complete within a budget (0 = unlimited), or by a deadline in high
+    // resolution ticks (0 = none), call while locked
+    void beginCallback(double budgetSeconds);
+    void beginCallbackUntil(int64 deadline);
+    // returns true if the callbacks overran their budget and were interrupted, otherwise collects garbage which fits in
+    // the rest of the budget (see PythonCollector), does nothing if no callback was begun
+    bool endCallback();
+
+protected:
+    // called with the interpreter held whenever a fresh module context is created, before any script runs, binds
+    // the context scripts expect into the module's dictionary
+    virtual void prepareContext(py::dict scope) {}
+
+    // create a fresh module context, call while holding the interpreter
+    py::module_ createContext();
+
+    // update memory scripts view (e.g. through arrays) from outside the interpreter without waiting, runs the
+    // function while holding the global lock exclusively, returns false without running it if the lock is busy
+    template <typename Function>
+    static bool tryExclusive(Function&& function)
+    {
+        std::unique_lock lock(g_mutex, std::try_to_lock);
+        if (!lock.owns_lock())
+            return false;
+        function();
+        return true;
+    }
+
+    //
+    // Script replacement
+    //
+    // A script is loaded while the running one keeps processing: lockLoad holds the GIL but not the global lock, so
+    // callbacks get their turn whenever the loading thread hands over the GIL (the switch interval is shortened
+    // while loading), and loads are serialized among themselves. loadScript runs the script in a fresh module
+    // context, after which derived state can be built from getLoadedModule(). commitScript then swaps the loaded
+    // script in under the exclusive lock, and discardScript releases whichever script isn't running, outside it.
+    //
+    // If the running script defines exportState(), its result is handed to the new script's importState(state),
+    // so state such as phases or precomputed tables survives a reload (it's exported when loading starts). If the
+    // new script fails the running one is kept, so a typo doesn't interrupt playback. Helper modules which changed
+    // are reloaded under the exclusive lock, since the running script may be using them.
+    //
+
+    void lockLoad();
+    void unlockLoad();
+    // returns false if the script failed, call between lockLoad/unlockLoad
+    bool loadScript(const char* filename, const char* script);
+    py::module_& getLoadedModule() { return m_loaded.module; }
+    // count a further script file of the loaded script (e.g. a pipeline stage) as one of its dependencies
+    void addDependency(const std::string& file) { m_loaded.files.push_back(file); }
+    // call while locked
+    void commitScript();
+    // call between lockLoad/unlockLoad
+    void discardScript();
+
 private:
     //
     // Retain an extra reference to our own dll
@@ -55,17 +135,101 @@ private:
 
     void retain() const;
 
-    // (re)initialize the execution context
+    // take the GIL with the calling thread's state, registering the thread on first use
+    static void restoreThread();
+
+    // deadline enforcement, used by PythonWatchdog
+    friend class PythonWatchdog;
+    friend class PythonProfiler;
+    friend class PythonCollector;
+    bool isCallbackExpired(int64 now) const;
+    void interrupt(int64 now);
+
+    // initialize the execution context
     void initContext();
 
+    //
+    // Import management
+    //
+    // Script directories are added to sys.path once, and an __import__ hook records which helper modules
+    // (modules living in one of those directories) are imported by each script and by each other. When a
+    // script is executed again, any helper in its dependency chain whose source changed is reloaded along with the
+    // helpers importing it.
+    //
+
+    struct TrackedModule
+    {
+        std::string file;
+        std::filesystem::file_time_type modified;
+        // names of tracked modules imported by this module
+        std::set<std::string> imports;
+    };
+
+    static void installImportHook();
+    static void installOutputRedirect();
+    static void recordImport(py::handle name, py::handle globals, py::handle fromlist, int level);
+    static bool trackModule(const std::string& name);
+    void addImportPath(const std::string& path);
+    void reloadDependencies();
+    void updateDependencies();
+
     // static resources
     static std::unique_ptr<py::scoped_interpreter> g_interpreter;
-    static std::mutex g_mutex;
+    static std::shared_mutex g_mutex;
     static PyThreadState* g_mainState;
     static PyInterpreterState* g_mainInterpreter;
 
-    // per-instance module context
+    // serializes script loads, and the switch interval to restore once a load has finished
+    static std::mutex g_loadMutex;
+    static double g_switchInterval;
+
+    // static import resources (guarded by g_mutex, and by the GIL between shared holders)
+    static std::set<std::string> g_importPaths;
+    static std::map<std::string, TrackedModule> g_trackedModules;
+
+    // a script's module context and what's derived from running it
+    struct Script
+    {
+        py::module_ module;
+        std::string directory;
+        // tracked modules imported directly by the script, and further script files it depends on
+        std::set<std::string> imports;
+        std::vector<std::string> files;
+        // script opted into automatic garbage collection during its callbacks (see PythonCollector)
+        bool automaticCollection = false;
+    };
+
+    // per-instance module context, of the running script
     py::module_ m_module;
+    std::string m_scriptDirectory;
+
+    // script being loaded, or replaced until discarded (only touched by the loading thread and by commitScript)
+    Script m_loaded;
+
+    // per-instance output
+    PythonLog m_log;
+
+    // callback resources, the thread state is only valid while the callback is active
+    std::atomic<bool> m_callbackActive{ false };
+    PyThreadState* m_callbackState = nullptr;
+    std::atomic<int64> m_callbackDeadline{ 0 };
+    std::atomic<bool> m_callbackInterrupted{ false };
+    unsigned long m_callbackThread = 0;
+
+    // script opted into automatic garbage collection during its callbacks (see PythonCollector)
+    bool m_automaticCollection = false;
+
+    // profiler sampling this executor's callbacks, if any, and whether its trace function is installed
+    std::atomic<PythonProfiler*> m_profiler{ nullptr };
+    bool m_profiling = false;
+
+    // tracked modules imported directly by the script, and further script files it depends on
+    std::set<std::string> m_imports;
+    std::vector<std::string> m_files;
+
+    // source files of all tracked modules the script depends on
+    std::vector<std::string> m_dependencies;
+    std::mutex m_dependencyMutex;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(PythonExecutor)
 };
@@ -0,0 +1,175 @@
+//
+// File: PythonLog.cpp
+// Desc: Definitions for PythonLog class
+//
+
+#include "apu_python.h"
+
+// size of the ring buffer between the writing thread and the drain thread
+static const int ringBytes = 256 * 1024;
+
+// longer writes are truncated
+static const size_t maxWriteBytes = 4096;
+
+// each write record starts with its length (16 bits) and level
+static const size_t recordHeaderBytes = 3;
+
+// rate limit, sustained and burst
+static const double bytesPerSecond = 32 * 1024;
+static const double burstBytes = 128 * 1024;
+
+// amount of text kept for display
+static const int maxHistoryChars = 64 * 1024;
+
+PythonLog::PythonLog() : m_fifo(ringBytes), m_tokens(burstBytes), m_lastRefill(Time::getMillisecondCounter())
+{
+    m_ring.allocate((size_t)ringBytes, true);
+    m_drain = std::thread([this]() { run(); });
+}
+
+PythonLog::~PythonLog()
+{
+    m_quit = true;
+    if (m_drain.joinable())
+        m_drain.join();
+}
+
+void PythonLog::write(Level level, const char* text, size_t length, bool newline)
+{
+    length = jmin(length, maxWriteBytes - (newline ? 1 : 0));
+
+    // token bucket, refilled at the sustained rate
+    const uint32 now = Time::getMillisecondCounter();
+    m_tokens = jmin(burstBytes, m_tokens + (double)(now - m_lastRefill) * bytesPerSecond / 1000.0);
+    m_lastRefill = now;
+    if (m_tokens < (double)length) {
+        ++m_rateDropped;
+        return;
+    }
+    m_tokens -= (double)length;
+
+    // push the whole record, or nothing at all
+    char record[recordHeaderBytes + maxWriteBytes];
+    record[2] = (char)level;
+    memcpy(record + recordHeaderBytes, text, length);
+    if (newline)
+        record[recordHeaderBytes + length++] = '\n';
+
+    record[0] = (char)(length & 0xff);
+    record[1] = (char)(length >> 8);
+
+    const int size = (int)(recordHeaderBytes + length);
+    if (m_fifo.getFreeSpace() < size) {
+        ++m_overflowDropped;
+        return;
+    }
+
+    int start1, size1, start2, size2;
+    m_fifo.prepareToWrite(size, start1, size1, start2, size2);
+    memcpy(m_ring.get() + start1, record, (size_t)size1);
+    memcpy(m_ring.get() + start2, record + size1, (size_t)size2);
+    m_fifo.finishedWrite(size1 + size2);
+}
+
+bool PythonLog::getHistory(String& text, int64& version)
+{
+    std::lock_guard lock(m_mutex);
+    if (version == m_version)
+        return false;
+
+    text = m_history;
+    version = m_version;
+    return true;
+}
+
+void PythonLog::clear()
+{
+    std::lock_guard lock(m_mutex);
+    m_history.clear();
+    ++m_version;
+}
+
+bool PythonLog::setFile(const File& file)
+{
+    std::lock_guard lock(m_mutex);
+    m_stream.reset();
+    m_file = File();
+    if (file == File())
+        return true;
+
+    m_stream = std::make_unique<FileOutputStream>(file);
+    if (m_stream->failedToOpen()) {
+        m_stream.reset();
+        return false;
+    }
+
+    m_file = file;
+    return true;
+}
+
+File PythonLog::getFile()
+{
+    std::lock_guard lock(m_mutex);
+    return m_file;
+}
+
+void PythonLog::run()
+{
+    static const uint32_t polling_interval = 20;
+
+    std::vector<char> pending;
+    int reportedDrops = 0;
+
+    for (;;) {
+        // sample the quit flag first, so the final pass drains everything written before destruction
+        const bool quit = m_quit.load();
+
+        int start1, size1, start2, size2;
+        m_fifo.prepareToRead(m_fifo.getNumReady(), start1, size1, start2, size2);
+        pending.assign(m_ring.get() + start1, m_ring.get() + start1 + size1);
+        pending.insert(pending.end(), m_ring.get() + start2, m_ring.get() + start2 + size2);
+        m_fifo.finishedRead(size1 + size2);
+
+        // records are pushed whole, so the pending bytes always hold complete records
+        for (size_t offset = 0; offset + recordHeaderBytes <= pending.size();) {
+            const auto length = (size_t)(uint8)pending[offset] | ((size_t)(uint8)pending[offset + 1] << 8);
+            const auto level = (Level)pending[offset + 2];
+            const char* text = pending.data() + offset + recordHeaderBytes;
+            fwrite(text, 1, length, level == LevelError ? stderr : stdout);
+            append(String::fromUTF8(text, (int)length));
+            offset += recordHeaderBytes + length;
+        }
+
+        // report drops once they've happened
+        const int drops = m_rateDropped + m_overflowDropped;
+        if (drops != reportedDrops) {
+            append("[" + String(drops - reportedDrops) + " writes dropped]\n");
+            reportedDrops = drops;
+        }
+
+        if (quit)
+            break;
+
+        if (pending.empty())
+            std::this_thread::sleep_for(std::chrono::milliseconds(polling_interval));
+    }
+}
+
+void PythonLog::append(const String& text)
+{
+    std::lock_guard lock(m_mutex);
+
+    // keep the most recent text, trimmed at a line boundary
+    m_history += text;
+    if (m_history.length() > maxHistoryChars) {
+        const auto trimmed = m_history.substring(m_history.length() - maxHistoryChars);
+        const auto newline = trimmed.indexOfChar('\n');
+        m_history = newline >= 0 ? trimmed.substring(newline + 1) : trimmed;
+    }
+    ++m_version;
+
+    if (m_stream != nullptr) {
+        m_stream->writeText(text, false, false, nullptr);
+        m_stream->flush();
+    }
+}
@@ -0,0 +1,82 @@
+//
+// File: PythonLog.h
+// Desc: Declarations for PythonLog class
+//
+
+#ifndef PYTHON_LOG_H
+#define PYTHON_LOG_H
+
+#include "apu_python.h"
+
+#include <mutex>
+#include <thread>
+#include <atomic>
+
+//
+// PythonLog
+//
+// Captures a script's output (print, sys.stdout/stderr) and errors without blocking the calling thread. Text is
+// pushed into a lock-free ring buffer, and a drain thread moves it into a bounded history for display, echoes it
+// to stdout and optionally appends it to a log file. Writes which exceed the rate limit or don't fit in the ring
+// are dropped and counted.
+//
+
+class PythonLog
+{
+public:
+    enum Level : uint8
+    {
+        LevelOutput,
+        LevelError
+    };
+
+    PythonLog();
+    ~PythonLog();
+
+    // producer interface, never blocks (callers must be serialized, which the GIL does for scripts)
+    void write(Level level, const char* text, size_t length, bool newline = false);
+    void writeLine(Level level, const char* text) { write(level, text, strlen(text), true); }
+
+    // copy the history if it changed since the given version, returns false if it didn't
+    bool getHistory(String& text, int64& version);
+    void clear();
+
+    // also append drained text to a file, pass File() to stop
+    bool setFile(const File& file);
+    File getFile();
+
+    int getRateDropped() const { return m_rateDropped; }
+    int getOverflowDropped() const { return m_overflowDropped; }
+
+private:
+    // drain thread
+    void run();
+    void append(const String& text);
+
+    // ring buffer from the writing thread to the drain thread
+    HeapBlock<char> m_ring;
+    AbstractFifo m_fifo;
+
+    // rate limiting state (writing thread only)
+    double m_tokens;
+    uint32 m_lastRefill;
+
+    // drop counters
+    std::atomic<int> m_rateDropped{ 0 };
+    std::atomic<int> m_overflowDropped{ 0 };
+
+    // drained history and log file
+    std::mutex m_mutex;
+    String m_history;
+    int64 m_version = 0;
+    File m_file;
+    std::unique_ptr<FileOutputStream> m_stream;
+
+    // drain thread resources
+    std::thread m_drain;
+    std::atomic<bool> m_quit{ false };
+
+    JUCE_DECLARE_NON_COPYABLE(PythonLog)
+};
+
+#endif /* PYTHON_LOG_H */
@@ -0,0 +1,282 @@
+//
+// File: PythonProfiler.cpp
+// Desc: Definitions for PythonProfiler class
+//
+
+#include "apu_python.h"
+
+#include <frameobject.h>
+
+void PythonProfiler::start(int intervalMs)
+{
+    if (isRunning())
+        return;
+
+    m_quit = false;
+    m_executor.m_profiler = this;
+    m_thread = std::thread([this, intervalMs]() { run(intervalMs); });
+}
+
+void PythonProfiler::stop()
+{
+    if (!isRunning())
+        return;
+
+    m_quit = true;
+    m_thread.join();
+
+    // wait for a callback still using the profiler, later callbacks don't install it
+    m_executor.m_profiler = nullptr;
+    m_executor.lock();
+    drain();
+    releaseCodes();
+    m_executor.unlock();
+}
+
+void PythonProfiler::reset()
+{
+    std::lock_guard lock(m_mutex);
+    m_stacks.clear();
+    m_samples = 0;
+    m_dropped = 0;
+
+    // the names are only needed by counted stacks, and nothing adds to the table while stopped
+    if (!isRunning())
+        m_numCodes = 0;
+}
+
+void PythonProfiler::run(int intervalMs)
+{
+    while (!m_quit.load()) {
+        // a request left over from a callback which has ended would land at the start of the next one
+        m_sampleRequested = m_executor.m_callbackActive.load();
+        std::this_thread::sleep_for(std::chrono::milliseconds(intervalMs));
+        drain();
+    }
+}
+
+void PythonProfiler::drain()
+{
+    int start1, size1, start2, size2;
+    m_fifo.prepareToRead(m_fifo.getNumReady(), start1, size1, start2, size2);
+
+    std::lock_guard lock(m_mutex);
+    auto count = [this](int start, int size) {
+        for (int i = start; i < start + size; ++i) {
+            const auto& sample = m_ring[(size_t)i];
+            std::vector<std::pair<int, int>> stack;
+            for (int j = sample.depth - 1; j >= 0; --j)
+                stack.emplace_back(sample.codes[j], sample.lines[j]);
+            ++m_stacks[stack];
+            ++m_samples;
+        }
+    };
+    count(start1, size1);
+    count(start2, size2);
+    m_fifo.finishedRead(size1 + size2);
+}
+
+void PythonProfiler::releaseCodes()
+{
+    // the names stay for the counted stacks, but a code object seen again after a restart gets a new entry
+    for (int i = 0; i < m_numCodes; ++i)
+        Py_CLEAR(m_codes[(size_t)i].code);
+    std::fill(m_index.begin(), m_index.end(), -1);
+}
+
+int PythonProfiler::trace(PyObject* object, PyFrameObject* frame, int what, PyObject* arg)
+{
+    auto executor = PythonExecutor::getCurrent();
+    auto profiler = executor != nullptr ? executor->m_profiler.load() : nullptr;
+    if (profiler != nullptr && frame != nullptr && profiler->m_sampleRequested.load(std::memory_order_relaxed)
+        && profiler->m_sampleRequested.exchange(false))
+        profiler->sample(frame);
+    return 0;
+}
+
+static void copyName(PyObject* object, char* name, size_t size, bool fileName)
+{
+    // compact ASCII strings (nearly all names) are read in place, others are encoded once when first seen
+    Py_ssize_t length = 0;
+    const char* utf8 = object != nullptr ? PyUnicode_AsUTF8AndSize(object, &length) : nullptr;
+    if (utf8 == nullptr) {
+        PyErr_Clear();
+        utf8 = "?";
+        length = 1;
+    }
+
+    if (fileName) {
+        for (Py_ssize_t i = length; i > 0; --i) {
+            if (utf8[i - 1] == '/' || utf8[i - 1] == '\\') {
+                utf8 += i;
+                length -= i;
+                break;
+            }
+        }
+    }
+
+    const size_t copied = std::min((size_t)length, size - 1);
+    std::memcpy(name, utf8, copied);
+    name[copied] = 0;
+}
+
+int PythonProfiler::findCode(PyObject* code)
+{
+    // open addressing on the object's address, the table only grows until stop
+    size_t hash = ((size_t)(uintptr_t)code >> 4) & (indexSize - 1);
+    for (int probe = 0; probe < indexSize; ++probe, hash = (hash + 1) & (indexSize - 1)) {
+        int& slot = m_index[hash];
+        if (slot >= 0 && m_codes[(size_t)slot].code == code)
+            return slot;
+        if (slot >= 0)
+            continue;
+        if (m_numCodes == maxCodes)
+            return -1;
+
+        auto& entry = m_codes[(size_t)m_numCodes];
+        Py_INCREF(code);
+        entry.code = code;
+        copyName(((PyCodeObject*)code)->co_name, entry.name, sizeof(entry.name), false);
+        copyName(((PyCodeObject*)code)->co_filename, entry.file, sizeof(entry.file), true);
+        slot = m_numCodes++;
+        return slot;
+    }
+
+    return -1;
+}
+
+void PythonProfiler::sample(PyFrameObject* current)
+{
+    // a full ring or code table drops the sample rather than allocating
+    int start1, size1, start2, size2;
+    m_fifo.prepareToWrite(1, start1, size1, start2, size2);
+    if (size1 == 0) {
+        ++m_dropped;
+        return;
+    }
+
+    auto& sample = m_ring[(size_t)start1];
+    sample.depth = 0;
+
+    // every frame of the callback was entered with the trace function installed, so walking back doesn't create
+    // frame objects; stacks deeper than maxDepth lose their outermost frames
+    PyFrameObject* frame = current;
+    Py_INCREF(frame);
+    while (frame != nullptr && sample.depth < maxDepth) {
+#if PY_VERSION_HEX >= 0x03090000
+        PyCodeObject* code = PyFrame_GetCode(frame);
+#else
+        PyCodeObject* code = frame->f_code;
+        Py_INCREF(code);
+#endif
+        const int slot = findCode((PyObject*)code);
+        Py_DECREF(code);
+        if (slot < 0) {
+            Py_DECREF(frame);
+            ++m_dropped;
+            return;
+        }
+
+        sample.codes[sample.depth] = slot;
+        sample.lines[sample.depth] = PyFrame_GetLineNumber(frame);
+        ++sample.depth;
+
+#if PY_VERSION_HEX >= 0x03090000
+        PyFrameObject* back = PyFrame_GetBack(frame);
+#else
+        PyFrameObject* back = frame->f_back;
+        Py_XINCREF(back);
+#endif
+        Py_DECREF(frame);
+        frame = back;
+    }
+    Py_XDECREF(frame);
+
+    m_fifo.finishedWrite(sample.depth > 0 ? 1 : 0);
+}
+
+String PythonProfiler::getLocation(const std::pair<int, int>& frame) const
+{
+    const auto& code = m_codes[(size_t)frame.first];
+    return String(code.name) + " (" + String(code.file) + ":" + String(frame.second) + ")";
+}
+
+String PythonProfiler::getReport(int maxRows)
+{
+    std::map<String, int> self;
+    std::map<String, int> total;
+    int samples = 0;
+
+    // attribute each stack's samples to its innermost frame (self) and to every distinct frame in it (total)
+    {
+        std::lock_guard lock(m_mutex);
+        samples = m_samples;
+        for (auto& entry : m_stacks) {
+            StringArray frames;
+            for (auto& frame : entry.first)
+                frames.add(getLocation(frame));
+            self[frames[frames.size() - 1]] += entry.second;
+            frames.removeDuplicates(false);
+            for (auto& frame : frames)
+                total[frame] += entry.second;
+        }
+    }
+
+    std::vector<std::pair<String, int>> rows(self.begin(), self.end());
+    std::sort(rows.begin(), rows.end(), [](auto& a, auto& b) { return a.second > b.second; });
+
+    // garbage collection runs outside the callbacks, but its pauses are what a late block would be waiting on
+    const auto gc = PythonCollector::getInstance().getStats();
+    const auto gcCollections = gc.collections[0] + gc.collections[1] + gc.collections[2];
+
+    // thread states held by host threads, and waiting for reuse
+    const auto states = PythonThreadStatePool::getInstance().getStats();
+    const auto assets = PythonAssets::getInstance().getStats();
+
+    String report;
+    report << "gc: " << gc.collections[0] << "/" << gc.collections[1] << "/" << gc.collections[2] << " collections (gen 0/1/2), "
+           << gc.collected << " collected, " << gc.pending << " pending, " << gc.idleCollections << " idle, pause avg "
+           << String(gcCollections > 0 ? gc.totalPauseMs / (double)gcCollections : 0.0, 3) << " ms, max " << String(gc.maxPauseMs, 3) << " ms\n";
+    report << "thread states: " << states.live << " live, " << states.idle << " idle, " << states.created << " created, "
+           << states.reused << " reused, " << states.deleted << " deleted\n";
+    report << "assets: " << assets.mapped << " mapped, " << File::descriptionOfSizeInBytes(assets.bytes) << "\n";
+    if (auto* scheduler = PythonScheduler::getInstance()) {
+        const auto jobs = scheduler->getStats();
+        report << "scheduler: " << jobs.workers << " workers, " << jobs.completed << " jobs, " << jobs.stolen << " stolen, "
+               << jobs.cancelled << " cancelled, max latency " << String(jobs.maxLatencyMs, 3) << " ms, busy";
+        for (auto busyMs : jobs.busyMs)
+            report << " " << String(busyMs, 0);
+        report << " ms\n";
+    }
+    report << samples << " samples, " << m_dropped.load() << " dropped\n";
+    report << "  self%  total%  samples  location\n";
+    for (size_t i = 0; i < rows.size() && (int)i < maxRows; ++i) {
+        const double scale = samples > 0 ? 100.0 / samples : 0.0;
+        report << String(rows[i].second * scale, 1).paddedLeft(' ', 7) << String(total[rows[i].first] * scale, 1).paddedLeft(' ', 8)
+               << String(rows[i].second).paddedLeft(' ', 9) << "  " << rows[i].first << "\n";
+    }
+
+    return report;
+}
+
+bool PythonProfiler::exportCollapsed(const File& file)
+{
+    FileOutputStream stream(file);
+    if (!stream.openedOk())
+        return false;
+
+    stream.setPosition(0);
+    stream.truncate();
+
+    std::lock_guard lock(m_mutex);
+    for (auto& entry : m_stacks) {
+        StringArray frames;
+        for (auto& frame : entry.first)
+            frames.add(getLocation(frame));
+
+        // spaces would split the frame from the count
+        stream << frames.joinIntoString(";").replaceCharacter(' ', '_') << " " << entry.second << "\n";
+    }
+
+    return true;
+}
@@ -0,0 +1,111 @@
+//
+// File: PythonProfiler.h
+// Desc: Declarations for PythonProfiler class
+//
+
+#ifndef PYTHON_PROFILER_H
+#define PYTHON_PROFILER_H
+
+#include "apu_python.h"
+
+#include <map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <string>
+#include <vector>
+
+//
+// PythonProfiler
+//
+// Sampling profiler for an executor's script callbacks. A separate thread periodically requests a sample, and the
+// callback thread takes it itself at its next line, call or return (a C trace function is installed for the duration
+// of each callback while profiling, see PythonExecutor::beginCallback), so the profiled thread never hands over the
+// GIL and loops without calls are still attributed to their lines. The callback thread only copies (code, line)
+// pairs into a preallocated ring; the sampling thread counts the stacks, and the report formats them from names
+// copied when each code object was first seen, so neither allocates on nor waits for the audio thread. Stacks are
+// reported as a table of per-line self/total samples, or exported in collapsed stack format ("outer;inner;leaf
+// count") for flame graph tools.
+//
+
+class PythonProfiler
+{
+public:
+    PythonProfiler(PythonExecutor& executor) : m_executor(executor) {}
+    ~PythonProfiler() { stop(); }
+
+    void start(int intervalMs = 5);
+    void stop();
+    void reset();
+    bool isRunning() const { return m_thread.joinable(); }
+
+    // table of the top locations, sorted by self samples
+    String getReport(int maxRows = 50);
+
+    // collapsed stack format, one stack per line
+    bool exportCollapsed(const File& file);
+
+private:
+    static constexpr int maxDepth = 32;
+    static constexpr int maxCodes = 1024;
+    static constexpr int indexSize = 2 * maxCodes;
+    static constexpr int ringSize = 256;
+
+    void run(int intervalMs);
+
+    // count the samples waiting in the ring (sampling thread)
+    void drain();
+
+    // release the sampled code objects, the executor must be locked
+    void releaseCodes();
+
+    // "function (file:line)" for a frame of a counted stack
+    String getLocation(const std::pair<int, int>& frame) const;
+
+    // trace function installed on the callback thread, takes a requested sample (called with the GIL held)
+    friend class PythonExecutor;
+    static int trace(PyObject* object, struct _frame* frame, int what, PyObject* arg);
+    void sample(struct _frame* frame);
+    int findCode(PyObject* code);
+
+    PythonExecutor& m_executor;
+    std::atomic<bool> m_sampleRequested{ false };
+
+    // code objects seen in samples, referenced until stop so their addresses aren't reused, and their names copied
+    // for the report (written by the callback thread, read once a sample using them has been through the ring)
+    struct Code
+    {
+        PyObject* code = nullptr;
+        char name[64] = {};
+        char file[64] = {};
+    };
+
+    std::vector<Code> m_codes = std::vector<Code>(maxCodes);
+    std::vector<int> m_index = std::vector<int>(indexSize, -1);
+    int m_numCodes = 0;
+
+    // raw samples from the callback thread, innermost frame first
+    struct Sample
+    {
+        int depth = 0;
+        int codes[maxDepth];
+        int lines[maxDepth];
+    };
+
+    std::vector<Sample> m_ring = std::vector<Sample>(ringSize);
+    AbstractFifo m_fifo{ ringSize };
+    std::atomic<int> m_dropped{ 0 };
+
+    // samples per stack of (code, line) from outermost to innermost
+    std::mutex m_mutex;
+    std::map<std::vector<std::pair<int, int>>, int> m_stacks;
+    int m_samples = 0;
+
+    // sampling thread resources
+    std::thread m_thread;
+    std::atomic<bool> m_quit{ false };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(PythonProfiler)
+};
+
+#endif /* PYTHON_PROFILER_H */
@@ -0,0 +1,209 @@
+//
+// File: PythonScheduler.cpp
+// Desc: Definitions for PythonScheduler class
+//
+
+#include "apu_python.h"
+
+// queued jobs reserved per worker, enough for every instance in a large session
+static const size_t reservedJobs = 256;
+
+static std::atomic<bool> g_disabled{ false };
+
+void PythonScheduler::disable() { g_disabled = true; }
+
+PythonScheduler* PythonScheduler::getInstance()
+{
+    if (g_disabled.load(std::memory_order_relaxed))
+        return nullptr;
+
+    static std::unique_ptr<PythonScheduler> scheduler = []() {
+        const int numWorkers = SystemStats::getEnvironmentVariable("APU_SCHEDULER_THREADS", "0").getIntValue();
+        return numWorkers > 0 ? std::unique_ptr<PythonScheduler>(new PythonScheduler(jmin(numWorkers, 16))) : nullptr;
+    }();
+    return scheduler.get();
+}
+
+PythonScheduler::PythonScheduler(int numWorkers)
+{
+    for (auto i = 0; i < numWorkers; ++i) {
+        m_workers.push_back(std::make_unique<Worker>());
+        m_workers.back()->queue.reserve(reservedJobs);
+    }
+    for (size_t i = 0; i < m_workers.size(); ++i)
+        m_workers[i]->thread = std::thread([this, i]() { run(i); });
+}
+
+PythonScheduler::~PythonScheduler()
+{
+    m_quit = true;
+    for (auto& worker : m_workers) {
+        worker->wakeUp.signal();
+        if (worker->thread.joinable())
+            worker->thread.join();
+    }
+}
+
+void PythonScheduler::submit(Job& job)
+{
+    job.submitted = Time::getHighResolutionTicks();
+    const uint64 sequence = ++job.sequence;
+    job.state = (sequence << 8) | Job::StateQueued;
+
+    // spread jobs over the workers, idle workers steal whatever isn't picked up quickly
+    const size_t index = m_next++ % m_workers.size();
+    {
+        auto& worker = *m_workers[index];
+        const SpinLock::ScopedLockType lock(worker.lock);
+        worker.queue.push_back({ &job, sequence, job.deadline });
+    }
+
+    // wake a single idle worker, preferring the queue's own, busy workers look at the queues again when they finish
+    for (size_t i = 0; i < m_workers.size(); ++i) {
+        auto& worker = *m_workers[(index + i) % m_workers.size()];
+        bool idle = true;
+        if (worker.idle.compare_exchange_strong(idle, false)) {
+            worker.wakeUp.signal();
+            break;
+        }
+    }
+}
+
+bool PythonScheduler::wait(Job& job)
+{
+    if (job.deadline == 0) {
+        job.done.wait(-1);
+        return true;
+    }
+
+    // sleep for the whole milliseconds left and yield for the rest, blocks can be shorter than a millisecond
+    const double remainingMs = 1000.0 * Time::highResolutionTicksToSeconds(job.deadline - Time::getHighResolutionTicks());
+    if (remainingMs >= 1.0 && job.done.wait((int)remainingMs))
+        return true;
+    while (job.getState() != Job::StateDone && Time::getHighResolutionTicks() < job.deadline)
+        std::this_thread::yield();
+    if (job.getState() == Job::StateDone) {
+        // consume the signal, which follows the state change
+        job.done.wait(-1);
+        return true;
+    }
+
+    // not picked up in time, the block passes through
+    uint64 expected = (job.sequence << 8) | Job::StateQueued;
+    if (job.state.compare_exchange_strong(expected, (job.sequence << 8) | Job::StateCancelled)) {
+        remove(job);
+        ++m_cancelled;
+        return false;
+    }
+
+    // already running, and interrupted once past the deadline
+    job.done.wait(-1);
+    return true;
+}
+
+void PythonScheduler::retire(Job& job)
+{
+    // once its entries are gone no worker can take the job, then wait out the ones which already did
+    remove(job);
+    while (job.takers.load() != 0)
+        std::this_thread::yield();
+}
+
+PythonScheduler::Stats PythonScheduler::getStats()
+{
+    Stats stats;
+    stats.workers = (int)m_workers.size();
+    stats.completed = m_completed;
+    stats.stolen = m_stolen;
+    stats.cancelled = m_cancelled;
+    stats.maxLatencyMs = m_maxLatencyMs;
+    for (auto& worker : m_workers)
+        stats.busyMs.push_back(worker->busyMs);
+    return stats;
+}
+
+void PythonScheduler::run(size_t index)
+{
+    Thread::setCurrentThreadPriority(9);
+
+    auto& own = *m_workers[index];
+    while (!m_quit.load()) {
+        Entry entry = take(index);
+
+        if (entry.job == nullptr) {
+            // announce we're idle before looking once more, so a job submitted in between either is found here or
+            // wakes us
+            own.idle = true;
+            entry = take(index);
+            if (entry.job == nullptr) {
+                own.wakeUp.wait(-1);
+                own.idle = false;
+                continue;
+            }
+            own.idle = false;
+        }
+
+        // skip submissions cancelled since they were queued, and entries of a submission which has been replaced
+        Job* job = entry.job;
+        uint64 expected = (entry.sequence << 8) | Job::StateQueued;
+        if (!job->state.compare_exchange_strong(expected, (entry.sequence << 8) | Job::StateRunning)) {
+            --job->takers;
+            continue;
+        }
+
+        const auto start = Time::getHighResolutionTicks();
+        const double latencyMs = 1000.0 * Time::highResolutionTicksToSeconds(start - job->submitted);
+        for (auto maxLatencyMs = m_maxLatencyMs.load(); latencyMs > maxLatencyMs && !m_maxLatencyMs.compare_exchange_weak(maxLatencyMs, latencyMs);) {
+        }
+
+        job->run(job->context);
+
+        own.busyMs = own.busyMs + 1000.0 * Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - start);
+        ++m_completed;
+        job->state = (entry.sequence << 8) | Job::StateDone;
+        job->done.signal();
+        // the job may be destroyed from here on
+        --job->takers;
+    }
+}
+
+PythonScheduler::Entry PythonScheduler::take(size_t index)
+{
+    // earliest deadline first from our own queue, otherwise steal from the others
+    Entry entry = take(*m_workers[index]);
+    for (size_t i = 1; entry.job == nullptr && i < m_workers.size(); ++i) {
+        entry = take(*m_workers[(index + i) % m_workers.size()]);
+        if (entry.job != nullptr)
+            ++m_stolen;
+    }
+    return entry;
+}
+
+PythonScheduler::Entry PythonScheduler::take(Worker& worker)
+{
+    const SpinLock::ScopedLockType lock(worker.lock);
+    if (worker.queue.empty())
+        return {};
+
+    // queues are short, a linear scan beats keeping them sorted
+    auto earliest = worker.queue.begin();
+    for (auto it = worker.queue.begin() + 1; it != worker.queue.end(); ++it) {
+        if (it->deadline != 0 && (earliest->deadline == 0 || it->deadline < earliest->deadline))
+            earliest = it;
+    }
+
+    // counted while the entry is still visible to remove, so retire can't miss it
+    Entry entry = *earliest;
+    ++entry.job->takers;
+    worker.queue.erase(earliest);
+    return entry;
+}
+
+void PythonScheduler::remove(Job& job)
+{
+    for (auto& worker : m_workers) {
+        const SpinLock::ScopedLockType lock(worker->lock);
+        worker->queue.erase(std::remove_if(worker->queue.begin(), worker->queue.end(), [&job](const Entry& entry) { return entry.job == &job; }),
+            worker->queue.end());
+    }
+}
@@ -0,0 +1,133 @@
+//
+// File: PythonScheduler.h
+// Desc: Declarations for PythonScheduler class
+//
+
+#ifndef PYTHON_SCHEDULER_H
+#define PYTHON_SCHEDULER_H
+
+#include "apu_python.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+//
+// PythonScheduler
+//
+// Optional process-wide pool of worker threads which run the script work of every instance, enabled by setting
+// APU_SCHEDULER_THREADS to the number of workers. An audio thread submits its block as a job with a deadline and
+// waits for it. Each worker runs the job with the earliest deadline from its own queue, and steals from the other
+// queues when its own is empty, idle workers sleep until a job is submitted. A job which hasn't started by its
+// deadline is cancelled and the block passes through, a job which has started runs within what's left of the same
+// deadline (see PythonWatchdog), so the audio thread never waits much past it. Queue entries carry the
+// submission they were made for, so a worker which took an entry late can't start a later submission of the job,
+// and owners retire their job before destroying it.
+//
+// All instances share one interpreter, so scripts only run in parallel while native code has released the GIL,
+// but the workers keep the audio threads out of the global lock and give one place to measure script load.
+//
+
+class PythonScheduler
+{
+public:
+    struct Job
+    {
+        enum State
+        {
+            StateIdle,
+            StateQueued,
+            StateRunning,
+            StateDone,
+            StateCancelled
+        };
+
+        State getState() const { return (State)(state.load() & 0xff); }
+
+        // set by the submitting thread before submit, and only read by the worker which starts this submission
+        void (*run)(void* context) = nullptr;
+        void* context = nullptr;
+        // high resolution ticks, 0 = no deadline
+        int64 deadline = 0;
+        int64 submitted = 0;
+
+        // submission count in the upper bits and State in the low byte, so a worker still holding the queue entry
+        // of an earlier submission can't start this one
+        uint64 sequence = 0;
+        std::atomic<uint64> state{ StateIdle };
+        // workers which have taken an entry for the job and not finished with it yet (see retire)
+        std::atomic<int> takers{ 0 };
+        WaitableEvent done;
+    };
+
+    struct Stats
+    {
+        int workers = 0;
+        int64 completed = 0;
+        int64 stolen = 0;
+        int64 cancelled = 0;
+        // time between submission and a worker picking the job up
+        double maxLatencyMs = 0.0;
+        // time spent running jobs, per worker
+        std::vector<double> busyMs;
+    };
+
+    // the scheduler, or nullptr if it isn't enabled
+    static PythonScheduler* getInstance();
+    // keep the scheduler off in this process whatever the environment says, e.g. for tools which measure the
+    // calling thread
+    static void disable();
+
+    // queue a job, its run, context and deadline must be set
+    void submit(Job& job);
+    // wait for a job until its deadline, returns false if the job was cancelled without running
+    bool wait(Job& job);
+    // make sure no worker refers to a job any more, call before destroying it
+    void retire(Job& job);
+
+    Stats getStats();
+
+private:
+    PythonScheduler(int numWorkers);
+    ~PythonScheduler();
+
+    // a queued submission, with its deadline copied so ordering never reads a job being resubmitted
+    struct Entry
+    {
+        Job* job = nullptr;
+        uint64 sequence = 0;
+        int64 deadline = 0;
+    };
+
+    struct Worker
+    {
+        SpinLock lock;
+        std::vector<Entry> queue;
+        WaitableEvent wakeUp;
+        // sleeping until signalled, cleared by the submitter which wakes it
+        std::atomic<bool> idle{ false };
+        std::thread thread;
+        std::atomic<double> busyMs{ 0.0 };
+    };
+
+    void run(size_t index);
+    // take the entry with the earliest deadline from a worker's queue, or from any other queue (stealing), counting
+    // the worker as one of the job's takers
+    Entry take(Worker& worker);
+    Entry take(size_t index);
+    void remove(Job& job);
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::atomic<size_t> m_next{ 0 };
+    std::atomic<bool> m_quit{ false };
+
+    std::atomic<int64> m_completed{ 0 };
+    std::atomic<int64> m_stolen{ 0 };
+    std::atomic<int64> m_cancelled{ 0 };
+    std::atomic<double> m_maxLatencyMs{ 0.0 };
+
+    JUCE_DECLARE_NON_COPYABLE(PythonScheduler)
+};
+
+#endif /* PYTHON_SCHEDULER_H */
@@ -0,0 +1,227 @@
+//
+// File: PythonSharedState.cpp
+// Desc: Definitions for PythonSharedState class
+//
+
+#include "apu_python.h"
+
+static_assert(sizeof(std::atomic<int16>) == sizeof(int16), "controller values are exposed as an int16 array");
+
+// slot states
+static const uint32 slotEmpty = 0;
+static const uint32 slotClaiming = 1;
+static const uint32 slotReady = 2;
+
+static uint32 hashKey(const char* key)
+{
+    // FNV-1a
+    uint32 hash = 2166136261u;
+    for (; *key != 0; ++key)
+        hash = (hash ^ (uint8)*key) * 16777619u;
+    return hash;
+}
+
+PythonSharedState& PythonSharedState::getInstance()
+{
+    static PythonSharedState state;
+    return state;
+}
+
+PythonSharedState::PythonSharedState()
+{
+    for (auto& channel : m_controls)
+        for (auto& control : channel)
+            control.store(-1, std::memory_order_relaxed);
+
+    for (auto& slot : m_slots)
+        for (auto& buffer : slot.buffers)
+            for (auto& word : buffer.words)
+                word.store(0, std::memory_order_relaxed);
+}
+
+void PythonSharedState::setControl(int channel, int controller, int value)
+{
+    if (isPositiveAndBelow(channel, numChannels) && isPositiveAndBelow(controller, numControllers))
+        m_controls[channel][controller].store((int16)value, std::memory_order_relaxed);
+}
+
+int PythonSharedState::getControl(int channel, int controller) const
+{
+    if (isPositiveAndBelow(channel, numChannels) && isPositiveAndBelow(controller, numControllers))
+        return m_controls[channel][controller].load(std::memory_order_relaxed);
+    return -1;
+}
+
+PythonSharedState::Slot* PythonSharedState::find(const char* key, bool create) const
+{
+    const auto length = strlen(key);
+    if (length == 0 || length > maxKeyLength)
+        return nullptr;
+
+    // open addressing with linear probing, slots are never freed so a probe ends at the first empty slot
+    const uint32 start = hashKey(key);
+    for (uint32 i = 0; i < (uint32)numSlots; ++i) {
+        auto& slot = m_slots[(start + i) & (numSlots - 1)];
+        auto state = slot.state.load(std::memory_order_acquire);
+
+        if (state == slotEmpty) {
+            if (!create)
+                return nullptr;
+            if (slot.state.compare_exchange_strong(state, slotClaiming, std::memory_order_acquire)) {
+                memcpy(slot.key, key, length + 1);
+                slot.state.store(slotReady, std::memory_order_release);
+                return &slot;
+            }
+        }
+
+        // another thread is claiming this slot, its key is needed to decide whether to move on
+        while (state == slotClaiming)
+            state = slot.state.load(std::memory_order_acquire);
+
+        if (strcmp(slot.key, key) == 0)
+            return &slot;
+    }
+
+    return nullptr;
+}
+
+bool PythonSharedState::set(const char* key, Type type, const void* data, size_t size)
+{
+    if (size > maxValueBytes)
+        return false;
+
+    auto slot = find(key, true);
+    if (slot == nullptr)
+        return false;
+
+    uint64 words[valueWords] = { (uint64)type | ((uint64)size << 8) };
+    memcpy(words + 1, data, size);
+
+    // one writer at a time per slot, writes are short so waiting writers just spin
+    while (slot->writer.exchange(1, std::memory_order_acquire) != 0)
+        std::this_thread::yield();
+
+    // fill the buffer readers aren't using, then flip to it
+    const auto next = slot->current.load(std::memory_order_relaxed) ^ 1;
+    auto& buffer = slot->buffers[next];
+    const auto sequence = buffer.sequence.load(std::memory_order_relaxed);
+    buffer.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < valueWords; ++i)
+        buffer.words[i].store(words[i], std::memory_order_relaxed);
+    buffer.sequence.store(sequence + 2, std::memory_order_release);
+    slot->current.store(next, std::memory_order_release);
+
+    slot->writer.store(0, std::memory_order_release);
+    return true;
+}
+
+bool PythonSharedState::get(const char* key, Type& type, void* data, size_t& size) const
+{
+    auto slot = find(key, false);
+    if (slot == nullptr)
+        return false;
+
+    // a reader only retries if a writer finished a whole write and started on this reader's buffer meanwhile
+    uint64 words[valueWords];
+    for (;;) {
+        const auto& buffer = slot->buffers[slot->current.load(std::memory_order_acquire)];
+        const auto sequence = buffer.sequence.load(std::memory_order_acquire);
+        if (sequence & 1)
+            continue;
+        for (size_t i = 0; i < valueWords; ++i)
+            words[i] = buffer.words[i].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (buffer.sequence.load(std::memory_order_relaxed) == sequence)
+            break;
+    }
+
+    type = (Type)(words[0] & 0xff);
+    size = jmin((size_t)(words[0] >> 8), maxValueBytes);
+    memcpy(data, words + 1, size);
+    return type != TypeNone;
+}
+
+void PythonSharedState::bind(py::module_& module)
+{
+    py::class_<PythonSharedState, std::unique_ptr<PythonSharedState, py::nodelete>>(module, "SharedState")
+        .def(
+            "set_control", [](PythonSharedState& state, int channel, int controller, int value) { state.setControl(channel - 1, controller, value); },
+            py::arg("channel"), py::arg("controller"), py::arg("value"), "set a controller value (channels are 1-16)")
+        .def(
+            "get_control", [](PythonSharedState& state, int channel, int controller) { return state.getControl(channel - 1, controller); },
+            py::arg("channel"), py::arg("controller"), "get a controller value (channels are 1-16), -1 if never set")
+        .def_property_readonly(
+            "controls",
+            [](PythonSharedState& state) {
+                // read-only [channel - 1, controller] view of the live values, created once and never released since
+                // it may outlive the interpreter's modules
+                static py::object* controls = [&state]() {
+                    py::str dummy; // prevent pybind11 from copying
+                    py::array array(py::dtype::of<int16>(), { numChannels, numControllers }, {}, (const void*)&state.m_controls[0][0], dummy);
+                    array.attr("setflags")(py::arg("write") = false);
+                    return new py::object(std::move(array));
+                }();
+                return *controls;
+            },
+            "controller values as a [channel - 1, controller] int16 array, -1 where never set")
+        .def(
+            "set",
+            [](PythonSharedState& state, const std::string& key, py::object value) {
+                bool result = false;
+                if (py::isinstance<py::bool_>(value)) {
+                    const bool b = value.cast<bool>();
+                    result = state.set(key.c_str(), TypeBool, &b, sizeof(b));
+                }
+                else if (py::isinstance<py::int_>(value)) {
+                    const int64 i = value.cast<int64>();
+                    result = state.set(key.c_str(), TypeInt, &i, sizeof(i));
+                }
+                else if (py::isinstance<py::float_>(value)) {
+                    const double d = value.cast<double>();
+                    result = state.set(key.c_str(), TypeFloat, &d, sizeof(d));
+                }
+                else if (py::isinstance<py::str>(value) || py::isinstance<py::bytes>(value)) {
+                    const std::string s = value.cast<std::string>();
+                    result = state.set(key.c_str(), py::isinstance<py::str>(value) ? TypeString : TypeBytes, s.data(), s.size());
+                }
+                else {
+                    throw py::type_error("shared values must be bool, int, float, str or bytes");
+                }
+                if (!result)
+                    throw py::value_error("shared key or value too long, or shared state full");
+            },
+            "publish a value to all instances")
+        .def(
+            "get",
+            [](PythonSharedState& state, const std::string& key, py::object fallback) -> py::object {
+                Type type;
+                char data[maxValueBytes];
+                size_t size = 0;
+                if (!state.get(key.c_str(), type, data, size))
+                    return fallback;
+                switch (type) {
+                    case TypeBool:
+                        return py::bool_(data[0] != 0);
+                    case TypeInt: {
+                        int64 i;
+                        memcpy(&i, data, sizeof(i));
+                        return py::int_(i);
+                    }
+                    case TypeFloat: {
+                        double d;
+                        memcpy(&d, data, sizeof(d));
+                        return py::float_(d);
+                    }
+                    case TypeString:
+                        return py::str(data, size);
+                    case TypeBytes:
+                        return py::bytes(data, size);
+                    default:
+                        return fallback;
+                }
+            },
+            py::arg("key"), py::arg("default") = py::none(), "read a value published by any instance");
+
+    module.attr("shared") = py::cast(&getInstance(), py::return_value_policy::reference);
+}
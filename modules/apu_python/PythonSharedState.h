@@ -0,0 +1,90 @@
+//
+// File: PythonSharedState.h
+// Desc: Declarations for PythonSharedState class
+//
+
+#ifndef PYTHON_SHARED_STATE_H
+#define PYTHON_SHARED_STATE_H
+
+#include "apu_python.h"
+
+#include <atomic>
+
+//
+// PythonSharedState
+//
+// Process-wide state shared between instances, exposed to scripts as apu.shared, so one instance can publish
+// controller state and the others read it from their own audio threads without going through the host.
+//
+// Controller values (16 channels of 128 controllers) are single atomic words. Scripts address channels as 1-16,
+// matching the midi hooks, the array view is indexed [channel - 1, controller]. Typed values live in a fixed table
+// of keyed slots, each double buffered behind a per-buffer sequence lock: a writer fills the inactive buffer and
+// then flips to it, so readers never wait on a writer, even one which is preempted mid-write.
+//
+
+class PythonSharedState
+{
+public:
+    static constexpr int numChannels = 16;
+    static constexpr int numControllers = 128;
+    static constexpr int numSlots = 256;
+    static constexpr size_t maxKeyLength = 31;
+    static constexpr size_t valueWords = 8;
+    // the first value word holds the type and size
+    static constexpr size_t maxValueBytes = (valueWords - 1) * sizeof(uint64);
+
+    enum Type : uint8
+    {
+        TypeNone,
+        TypeInt,
+        TypeFloat,
+        TypeBool,
+        TypeString,
+        TypeBytes
+    };
+
+    static PythonSharedState& getInstance();
+
+    // controller values, -1 until set (channels are 0-15 here, scripts use 1-16)
+    void setControl(int channel, int controller, int value);
+    int getControl(int channel, int controller) const;
+
+    // typed values by key, set returns false if the key or value is too long or the table is full
+    bool set(const char* key, Type type, const void* data, size_t size);
+    bool get(const char* key, Type& type, void* data, size_t& size) const;
+
+    // add the shared state to the given module as 'shared'
+    static void bind(py::module_& module);
+
+private:
+    PythonSharedState();
+
+    struct Buffer
+    {
+        // odd while being written
+        std::atomic<uint32> sequence{ 0 };
+        std::atomic<uint64> words[valueWords];
+    };
+
+    struct Slot
+    {
+        // empty, being claimed or ready, the key is immutable once ready
+        std::atomic<uint32> state{ 0 };
+        char key[maxKeyLength + 1];
+        // held by a writer while it fills the inactive buffer
+        std::atomic<uint32> writer{ 0 };
+        // buffer readers should use
+        std::atomic<uint32> current{ 0 };
+        Buffer buffers[2];
+    };
+
+    // find the slot for a key, optionally claiming a free one
+    Slot* find(const char* key, bool create) const;
+
+    std::atomic<int16> m_controls[numChannels][numControllers];
+    mutable Slot m_slots[numSlots];
+
+    JUCE_DECLARE_NON_COPYABLE(PythonSharedState)
+};
+
+#endif /* PYTHON_SHARED_STATE_H */
@@ -0,0 +1,109 @@
+//
+// File: PythonThreadStatePool.cpp
+// Desc: Definitions for PythonThreadStatePool class
+//
+
+#include "apu_python.h"
+
+// returns the calling thread's state to the pool when the thread exits
+struct ThreadRegistration
+{
+    ~ThreadRegistration()
+    {
+        if (state != nullptr)
+            PythonThreadStatePool::getInstance().release(state);
+    }
+
+    PyThreadState* state = nullptr;
+};
+
+static thread_local ThreadRegistration registration;
+
+PythonThreadStatePool& PythonThreadStatePool::getInstance()
+{
+    // never destroyed, threads may still exit after static destruction
+    static PythonThreadStatePool* pool = new PythonThreadStatePool();
+    return *pool;
+}
+
+PyThreadState* PythonThreadStatePool::acquire(PyInterpreterState* interpreter)
+{
+    if (registration.state != nullptr)
+        return registration.state;
+
+    std::lock_guard lock(m_mutex);
+    if (!m_idle.empty()) {
+        registration.state = m_idle.back();
+        m_idle.pop_back();
+        // the state is identified by the thread it was created on, e.g. for PyThreadState_SetAsyncExc and
+        // threading.get_native_id
+        registration.state->thread_id = PyThread_get_thread_ident();
+#ifdef PY_HAVE_THREAD_NATIVE_ID
+        registration.state->native_thread_id = PyThread_get_thread_native_id();
+#endif
+        ++m_stats.reused;
+    }
+    else {
+        registration.state = PyThreadState_New(interpreter);
+        ++m_stats.created;
+    }
+
+    ++m_stats.live;
+    return registration.state;
+}
+
+void PythonThreadStatePool::reserve(PyInterpreterState* interpreter, int count)
+{
+    std::lock_guard lock(m_mutex);
+    clearReleased();
+    while ((int)m_idle.size() < count) {
+        m_idle.push_back(PyThreadState_New(interpreter));
+        ++m_stats.created;
+    }
+}
+
+void PythonThreadStatePool::trim(int count)
+{
+    std::vector<PyThreadState*> states;
+    {
+        std::lock_guard lock(m_mutex);
+        clearReleased();
+        while ((int)m_idle.size() > count) {
+            states.push_back(m_idle.back());
+            m_idle.pop_back();
+            ++m_stats.deleted;
+        }
+    }
+
+    // idle states aren't current on any thread, so they can be deleted by whichever thread holds the GIL
+    for (auto state : states) {
+        PyThreadState_Clear(state);
+        PyThreadState_Delete(state);
+    }
+}
+
+PythonThreadStatePool::Stats PythonThreadStatePool::getStats()
+{
+    std::lock_guard lock(m_mutex);
+    Stats stats = m_stats;
+    stats.idle = (int)(m_idle.size() + m_released.size());
+    return stats;
+}
+
+void PythonThreadStatePool::clearReleased()
+{
+    // states of exited threads still hold their last frame, exception and thread dict, clearing them needs the GIL
+    // so they're only reused once a processor reserves or trims
+    for (auto state : m_released) {
+        PyThreadState_Clear(state);
+        m_idle.push_back(state);
+    }
+    m_released.clear();
+}
+
+void PythonThreadStatePool::release(PyThreadState* state)
+{
+    std::lock_guard lock(m_mutex);
+    m_released.push_back(state);
+    --m_stats.live;
+}
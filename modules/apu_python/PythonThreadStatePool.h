@@ -0,0 +1,68 @@
+//
+// File: PythonThreadStatePool.h
+// Desc: Declarations for PythonThreadStatePool class
+//
+
+#ifndef PYTHON_THREAD_STATE_POOL_H
+#define PYTHON_THREAD_STATE_POOL_H
+
+#include "apu_python.h"
+
+#include <mutex>
+#include <atomic>
+#include <vector>
+
+//
+// PythonThreadStatePool
+//
+// Owns the Python thread states used by host threads. A thread is registered the first time it locks an
+// executor and takes an idle state from the pool, only creating one if none is left. When the thread exits its
+// state goes back to the pool instead of leaking, so hosts which churn through audio threads reuse a handful of
+// states. Processors reserve idle states in prepareToPlay, keeping creation off the audio thread, and trim the
+// pool in releaseResources. Returned states are cleared by the next reserve, under the GIL, before being reused.
+//
+
+class PythonThreadStatePool
+{
+public:
+    struct Stats
+    {
+        // states registered to a running thread, and states waiting in the pool
+        int live = 0;
+        int idle = 0;
+        int64 created = 0;
+        int64 reused = 0;
+        int64 deleted = 0;
+    };
+
+    static PythonThreadStatePool& getInstance();
+
+    // thread state of the calling thread, registering it on first use (call before taking the GIL)
+    PyThreadState* acquire(PyInterpreterState* interpreter);
+
+    // make sure at least count idle states are available, call while locked
+    void reserve(PyInterpreterState* interpreter, int count);
+    // delete idle states beyond count, call while locked
+    void trim(int count);
+
+    Stats getStats();
+
+private:
+    PythonThreadStatePool() {}
+
+    // return a state to the pool, called when its thread exits
+    void release(PyThreadState* state);
+    // make returned states idle, call while locked with m_mutex held
+    void clearReleased();
+    friend struct ThreadRegistration;
+
+    std::mutex m_mutex;
+    // cleared states ready for a thread, and states returned by exited threads waiting to be cleared
+    std::vector<PyThreadState*> m_idle;
+    std::vector<PyThreadState*> m_released;
+    Stats m_stats;
+
+    JUCE_DECLARE_NON_COPYABLE(PythonThreadStatePool)
+};
+
+#endif /* PYTHON_THREAD_STATE_POOL_H */
@@ -0,0 +1,88 @@
+//
+// File: PythonWatchdog.cpp
+// Desc: Definitions for PythonWatchdog class
+//
+
+#include "apu_python.h"
+
+PythonWatchdog& PythonWatchdog::getInstance()
+{
+    static PythonWatchdog watchdog;
+    return watchdog;
+}
+
+PythonWatchdog::~PythonWatchdog()
+{
+    m_quit = true;
+    m_wakeUp.signal();
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+void PythonWatchdog::add(PythonExecutor* executor)
+{
+    std::lock_guard lock(m_mutex);
+    m_executors.push_back(executor);
+
+    // start watching once the first executor shows up
+    if (!m_thread.joinable())
+        m_thread = std::thread([this]() { run(); });
+}
+
+void PythonWatchdog::remove(PythonExecutor* executor)
+{
+    std::lock_guard lock(m_mutex);
+    m_executors.erase(std::remove(m_executors.begin(), m_executors.end(), executor), m_executors.end());
+}
+
+void PythonWatchdog::arm(int64 deadline)
+{
+    if (deadline < m_wakeTime.load())
+        m_wakeUp.signal();
+}
+
+void PythonWatchdog::run()
+{
+    std::vector<PythonExecutor*> expired;
+
+    while (!m_quit.load()) {
+        const auto now = Time::getHighResolutionTicks();
+        expired.clear();
+        const auto next = scan(now, expired);
+
+        if (!expired.empty()) {
+            // the GIL is needed to raise the exception, it's taken without holding our mutex so add/remove never
+            // wait on it, and each executor is checked to still be registered before it's touched
+            PyGILState_STATE state = PyGILState_Ensure();
+            {
+                std::lock_guard lock(m_mutex);
+                for (auto executor : expired)
+                    if (std::find(m_executors.begin(), m_executors.end(), executor) != m_executors.end())
+                        executor->interrupt(now);
+            }
+            PyGILState_Release(state);
+            continue;
+        }
+
+        // publish the wake up time, then look again in case a callback was armed meanwhile (see arm)
+        m_wakeTime = next;
+        if (scan(now, expired) < next)
+            continue;
+
+        const int timeout = next == noDeadline ? -1 : jmax(1, (int)std::ceil(1000.0 * Time::highResolutionTicksToSeconds(next - now)));
+        m_wakeUp.wait(timeout);
+    }
+}
+
+int64 PythonWatchdog::scan(int64 now, std::vector<PythonExecutor*>& expired)
+{
+    std::lock_guard lock(m_mutex);
+    int64 next = noDeadline;
+    for (auto executor : m_executors) {
+        if (executor->isCallbackExpired(now))
+            expired.push_back(executor);
+        else if (executor->m_callbackDeadline != 0 && !executor->m_callbackInterrupted)
+            next = jmin(next, executor->m_callbackDeadline.load());
+    }
+    return next;
+}
@@ -0,0 +1,60 @@
+//
+// File: PythonWatchdog.h
+// Desc: Declarations for PythonWatchdog class
+//
+
+#ifndef PYTHON_WATCHDOG_H
+#define PYTHON_WATCHDOG_H
+
+#include "apu_python.h"
+
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <limits>
+
+//
+// PythonWatchdog
+//
+// Process-wide thread which watches script callbacks (see PythonExecutor::beginCallback) and interrupts any
+// callback which runs past its deadline by raising TimeoutError asynchronously in the calling thread. The thread
+// sleeps until the earliest armed deadline, or until a callback is armed when none is.
+//
+
+class PythonWatchdog
+{
+public:
+    static PythonWatchdog& getInstance();
+
+    // register/unregister an executor to be watched (must not be called with the GIL held)
+    void add(PythonExecutor* executor);
+    void remove(PythonExecutor* executor);
+
+    // a callback was armed with the given deadline (high resolution ticks), wakes the thread if it would oversleep it
+    void arm(int64 deadline);
+
+private:
+    PythonWatchdog() {}
+    ~PythonWatchdog();
+
+    void run();
+    // find the callbacks which have expired, returns the earliest deadline still pending (noDeadline if none)
+    int64 scan(int64 now, std::vector<PythonExecutor*>& expired);
+
+    static constexpr int64 noDeadline = std::numeric_limits<int64>::max();
+
+    // watched executors
+    std::mutex m_mutex;
+    std::vector<PythonExecutor*> m_executors;
+
+    // watchdog thread resources, and when it's next due to wake up
+    std::thread m_thread;
+    std::atomic<bool> m_quit{ false };
+    WaitableEvent m_wakeUp;
+    std::atomic<int64> m_wakeTime{ noDeadline };
+
+    JUCE_DECLARE_NON_COPYABLE(PythonWatchdog)
+};
+
+#endif /* PYTHON_WATCHDOG_H */
@@ -3,7 +3,15 @@
 // Desc: Pulls in compilation units for this module
 //
 
+#include "PythonLog.cpp"
 #include "PythonExecutor.cpp"
+#include "PythonWatchdog.cpp"
+#include "PythonCollector.cpp"
+#include "PythonThreadStatePool.cpp"
+#include "PythonScheduler.cpp"
+#include "PythonProfiler.cpp"
+#include "PythonSharedState.cpp"
+#include "PythonAssets.cpp"
 #include "PythonCodeTokeniser.cpp"
 #include "PythonEditor.cpp"
 #include "PythonAudioProcessor.cpp"
@@ -10,7 +10,7 @@
   website:            http://www.caustik.com/
   license:            Commercial
 
-  dependencies:       juce_gui_extra
+  dependencies:       juce_gui_extra apu_trace
   windowsLibs:        python36
 
  END_JUCE_MODULE_DECLARATION
@@ -23,10 +23,19 @@
 #include <JuceHeader.h>
 #include <juce_gui_extra/juce_gui_extra.h>
 #include <juce_audio_processors/juce_audio_processors.h>
+#include <apu_trace/apu_trace.h>
 using namespace juce;
 
 #pragma warning(disable : 4100)
+#include "PythonLog.h"
 #include "PythonExecutor.h"
+#include "PythonWatchdog.h"
+#include "PythonCollector.h"
+#include "PythonThreadStatePool.h"
+#include "PythonScheduler.h"
+#include "PythonProfiler.h"
+#include "PythonSharedState.h"
+#include "PythonAssets.h"
 #include "PythonCodeTokeniserFunctions.h"
 #include "PythonCodeTokeniser.h"
 #include "PythonEditor.h"
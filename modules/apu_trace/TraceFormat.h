@@ -0,0 +1,84 @@
+//
+// File: TraceFormat.h
+// Desc: Binary layout of trace files
+//
+
+#ifndef TRACE_FORMAT_H
+#define TRACE_FORMAT_H
+
+#include "apu_trace.h"
+
+//
+// Trace
+//
+// A trace file is a FileHeader followed by one record per processed block:
+//
+//   BlockHeader
+//   input events    (numInputEvents x Event, as received by processBlock)
+//   input audio     (numChannels x numSamples float32, channel after channel, optional)
+//   output events   (numOutputEvents x Event, as produced by processBlock)
+//
+// Each Event is followed by its MIDI bytes, padded to a multiple of 4 bytes.
+//
+
+namespace Trace
+{
+    static const uint32 fileMagic = 0x54555041; // "APUT"
+    static const uint32 blockMagic = 0x4b4c4241; // "ABLK"
+    static const uint32 version = 1;
+
+    enum TransportFlags : uint32
+    {
+        TransportValid = 1 << 0,
+        TransportPlaying = 1 << 1,
+        TransportRecording = 1 << 2,
+        TransportLooping = 1 << 3
+    };
+
+#pragma pack(push, 4)
+    struct FileHeader
+    {
+        uint32 magic;
+        uint32 version;
+        double sampleRate;
+        int32 maxBlockSize;
+        int32 numChannels;
+        char name[64];
+    };
+
+    struct BlockHeader
+    {
+        uint32 magic;
+        // total size of the record, including this header
+        uint32 size;
+        uint64 index;
+        uint32 numSamples;
+        uint32 numChannels;
+        uint32 numInputEvents;
+        uint32 inputEventBytes;
+        uint32 numOutputEvents;
+        uint32 outputEventBytes;
+        // transport state at the start of the block
+        uint32 transportFlags;
+        int32 timeSigNumerator;
+        int32 timeSigDenominator;
+        double bpm;
+        double ppqPosition;
+        double ppqPositionOfLastBarStart;
+        double ppqLoopStart;
+        double ppqLoopEnd;
+        int64 timeInSamples;
+    };
+
+    struct Event
+    {
+        int32 samplePosition;
+        uint32 size;
+    };
+#pragma pack(pop)
+
+    // size of an event and its padded MIDI bytes
+    static inline size_t getEventSize(size_t numBytes) { return sizeof(Event) + ((numBytes + 3) & ~(size_t)3); }
+}
+
+#endif /* TRACE_FORMAT_H */
@@ -0,0 +1,84 @@
+//
+// File: TraceReader.cpp
+// Desc: Definitions for TraceReader class
+//
+
+#include "apu_trace.h"
+
+bool TraceReader::open(const File& file)
+{
+    m_map = std::make_unique<MemoryMappedFile>(file, MemoryMappedFile::readOnly);
+    if (m_map->getData() == nullptr || m_map->getSize() < sizeof(Trace::FileHeader)) {
+        m_map.reset();
+        return false;
+    }
+
+    const auto& header = getHeader();
+    if (header.magic != Trace::fileMagic || header.version != Trace::version) {
+        m_map.reset();
+        return false;
+    }
+
+    rewind();
+    return true;
+}
+
+bool TraceReader::readNextBlock(Block& block)
+{
+    if (m_map == nullptr || m_position + sizeof(Trace::BlockHeader) > m_map->getSize())
+        return false;
+
+    auto data = static_cast<const uint8*>(m_map->getData()) + m_position;
+    auto header = reinterpret_cast<const Trace::BlockHeader*>(data);
+    if (header->magic != Trace::blockMagic || header->size < sizeof(Trace::BlockHeader) || m_position + header->size > m_map->getSize())
+        return false;
+
+    const size_t audioBytes = (size_t)header->numChannels * header->numSamples * sizeof(float);
+    if (sizeof(Trace::BlockHeader) + header->inputEventBytes + audioBytes + header->outputEventBytes != header->size)
+        return false;
+
+    block.header = header;
+    block.inputEvents = data + sizeof(Trace::BlockHeader);
+    block.audio = header->numChannels > 0 ? reinterpret_cast<const float*>(block.inputEvents + header->inputEventBytes) : nullptr;
+    block.outputEvents = block.inputEvents + header->inputEventBytes + audioBytes;
+
+    m_position += header->size;
+    return true;
+}
+
+bool TraceReader::getEvents(const uint8* events, uint32 numEvents, uint32 numBytes, MidiBuffer& midiMessages)
+{
+    size_t remaining = numBytes;
+    for (uint32 i = 0; i < numEvents; ++i) {
+        if (remaining < sizeof(Trace::Event))
+            return false;
+        auto event = reinterpret_cast<const Trace::Event*>(events);
+        const size_t eventSize = Trace::getEventSize(event->size);
+        if (event->size > remaining || eventSize > remaining)
+            return false;
+        midiMessages.addEvent(event + 1, (int)event->size, event->samplePosition);
+        events += eventSize;
+        remaining -= eventSize;
+    }
+    return true;
+}
+
+bool TraceReader::getPosition(const Trace::BlockHeader& header, AudioPlayHead::CurrentPositionInfo& position)
+{
+    if (!(header.transportFlags & Trace::TransportValid))
+        return false;
+
+    position.resetToDefault();
+    position.isPlaying = (header.transportFlags & Trace::TransportPlaying) != 0;
+    position.isRecording = (header.transportFlags & Trace::TransportRecording) != 0;
+    position.isLooping = (header.transportFlags & Trace::TransportLooping) != 0;
+    position.timeSigNumerator = header.timeSigNumerator;
+    position.timeSigDenominator = header.timeSigDenominator;
+    position.bpm = header.bpm;
+    position.ppqPosition = header.ppqPosition;
+    position.ppqPositionOfLastBarStart = header.ppqPositionOfLastBarStart;
+    position.ppqLoopStart = header.ppqLoopStart;
+    position.ppqLoopEnd = header.ppqLoopEnd;
+    position.timeInSamples = header.timeInSamples;
+    return true;
+}
@@ -0,0 +1,51 @@
+//
+// File: TraceReader.h
+// Desc: Declarations for TraceReader class
+//
+
+#ifndef TRACE_READER_H
+#define TRACE_READER_H
+
+#include "apu_trace.h"
+
+//
+// TraceReader
+//
+// Reads the blocks of a trace file (see TraceRecorder) directly from a read-only memory mapping.
+//
+
+class TraceReader
+{
+public:
+    struct Block
+    {
+        const Trace::BlockHeader* header = nullptr;
+        const uint8* inputEvents = nullptr;
+        // numChannels x numSamples, or nullptr if audio wasn't recorded
+        const float* audio = nullptr;
+        const uint8* outputEvents = nullptr;
+    };
+
+    TraceReader() {}
+
+    bool open(const File& file);
+    const Trace::FileHeader& getHeader() const { return *static_cast<const Trace::FileHeader*>(m_map->getData()); }
+
+    // read the next block, returns false at the end of the trace (or at a truncated/corrupt block)
+    bool readNextBlock(Block& block);
+    void rewind() { m_position = sizeof(Trace::FileHeader); }
+
+    // decode events into a midi buffer, reading no more than numBytes, returns false if the events don't fit (corrupt)
+    static bool getEvents(const uint8* events, uint32 numEvents, uint32 numBytes, MidiBuffer& midiMessages);
+
+    // transport state of a block, in the form AudioPlayHead provides it
+    static bool getPosition(const Trace::BlockHeader& header, AudioPlayHead::CurrentPositionInfo& position);
+
+private:
+    std::unique_ptr<MemoryMappedFile> m_map;
+    size_t m_position = 0;
+
+    JUCE_DECLARE_NON_COPYABLE(TraceReader)
+};
+
+#endif /* TRACE_READER_H */
@@ -0,0 +1,257 @@
+//
+// File: TraceRecorder.cpp
+// Desc: Definitions for TraceRecorder class
+//
+
+#include "apu_trace.h"
+
+// space reserved for each block's midi events
+static const size_t stagingEventBytes = 64 * 1024;
+
+// minimum size of the ring buffer between the audio thread and the writer thread
+static const int minRingBytes = 4 * 1024 * 1024;
+
+// granularity at which the trace file is grown and mapped
+static const int64 chunkBytes = 16 * 1024 * 1024;
+
+TraceRecorder::~TraceRecorder() { stop(); }
+
+bool TraceRecorder::start(const File& file, const String& name, double sampleRate, int maxBlockSize, int numChannels, bool recordAudio)
+{
+    stop();
+
+    // allocate staging and ring memory up front, the audio thread never allocates
+    m_recordAudio = recordAudio;
+    m_stagingCapacity = sizeof(Trace::BlockHeader) + 2 * stagingEventBytes + (recordAudio ? (size_t)(numChannels * maxBlockSize) * sizeof(float) : 0);
+    m_staging.allocate(m_stagingCapacity, true);
+    const int ringBytes = jmax(minRingBytes, (int)(4 * m_stagingCapacity));
+    m_ring.allocate((size_t)ringBytes, true);
+    m_fifo = std::make_unique<AbstractFifo>(ringBytes);
+    m_staged = false;
+    m_index = 0;
+    m_dropped = 0;
+    m_failed = false;
+
+    // create the file and write its header
+    m_file = file;
+    m_file.deleteFile();
+    m_written = 0;
+    m_mapOffset = 0;
+
+    Trace::FileHeader header{};
+    header.magic = Trace::fileMagic;
+    header.version = Trace::version;
+    header.sampleRate = sampleRate;
+    header.maxBlockSize = maxBlockSize;
+    header.numChannels = numChannels;
+    name.copyToUTF8(header.name, sizeof(header.name));
+    if (!writeToFile(&header, sizeof(header))) {
+        closeFile();
+        return false;
+    }
+
+    m_quit = false;
+    m_writer = std::thread([this]() { run(); });
+    m_recording = true;
+    return true;
+}
+
+bool TraceRecorder::startFromEnvironment(const String& name, double sampleRate, int maxBlockSize, int numChannels)
+{
+    const String directory = SystemStats::getEnvironmentVariable("APU_TRACE_DIR", {});
+    if (directory.isEmpty())
+        return false;
+
+    const bool recordAudio = SystemStats::getEnvironmentVariable("APU_TRACE_AUDIO", "0") == "1";
+    const String filename = name + "-" + Time::getCurrentTime().formatted("%Y%m%d-%H%M%S") + "-" + String::toHexString(Random::getSystemRandom().nextInt());
+    return start(File(directory).getChildFile(filename + ".aputrace"), name, sampleRate, maxBlockSize, numChannels, recordAudio);
+}
+
+void TraceRecorder::stop()
+{
+    if (!m_recording.exchange(false))
+        return;
+
+    // wait for any block in flight on the audio thread
+    while (m_busy)
+        std::this_thread::yield();
+
+    // the writer drains whatever is left before exiting
+    m_quit = true;
+    if (m_writer.joinable())
+        m_writer.join();
+
+    closeFile();
+}
+
+void TraceRecorder::recordOutput(const MidiBuffer& midiMessages)
+{
+    if (!m_staged)
+        return;
+
+    m_staged = false;
+
+    auto& header = getStagedHeader();
+    if (!stageEvents(midiMessages, header.numOutputEvents, header.outputEventBytes)) {
+        dropBlock();
+        return;
+    }
+    header.size = (uint32)m_stagingSize;
+
+    // push the whole record, or nothing at all
+    if (m_fifo->getFreeSpace() < (int)m_stagingSize) {
+        dropBlock();
+        return;
+    }
+
+    int start1, size1, start2, size2;
+    m_fifo->prepareToWrite((int)m_stagingSize, start1, size1, start2, size2);
+    memcpy(m_ring.get() + start1, m_staging.get(), (size_t)size1);
+    memcpy(m_ring.get() + start2, m_staging.get() + size1, (size_t)size2);
+    m_fifo->finishedWrite(size1 + size2);
+
+    m_busy = false;
+}
+
+bool TraceRecorder::beginBlock(int numSamples, AudioPlayHead* playHead)
+{
+    m_staged = false;
+
+    if (!m_recording)
+        return false;
+
+    // re-check once busy is visible, stop() may have started tearing down in between
+    m_busy = true;
+    if (!m_recording) {
+        m_busy = false;
+        return false;
+    }
+
+    // the file can't take any more, count the rest of the recording as dropped
+    if (m_failed) {
+        dropBlock();
+        return false;
+    }
+
+    auto& header = getStagedHeader();
+    header = {};
+    header.magic = Trace::blockMagic;
+    header.index = m_index++;
+    header.numSamples = (uint32)numSamples;
+    m_stagingSize = sizeof(Trace::BlockHeader);
+
+    // transport state
+    AudioPlayHead::CurrentPositionInfo position;
+    if (playHead != nullptr && playHead->getCurrentPosition(position)) {
+        header.transportFlags = Trace::TransportValid;
+        header.transportFlags |= position.isPlaying ? Trace::TransportPlaying : 0;
+        header.transportFlags |= position.isRecording ? Trace::TransportRecording : 0;
+        header.transportFlags |= position.isLooping ? Trace::TransportLooping : 0;
+        header.timeSigNumerator = position.timeSigNumerator;
+        header.timeSigDenominator = position.timeSigDenominator;
+        header.bpm = position.bpm;
+        header.ppqPosition = position.ppqPosition;
+        header.ppqPositionOfLastBarStart = position.ppqPositionOfLastBarStart;
+        header.ppqLoopStart = position.ppqLoopStart;
+        header.ppqLoopEnd = position.ppqLoopEnd;
+        header.timeInSamples = position.timeInSamples;
+    }
+
+    return true;
+}
+
+bool TraceRecorder::stageEvents(const MidiBuffer& midiMessages, uint32& numEvents, uint32& numBytes)
+{
+    const size_t start = m_stagingSize;
+
+    for (const auto metaData : midiMessages) {
+        const size_t eventSize = Trace::getEventSize((size_t)metaData.numBytes);
+        if (m_stagingSize + eventSize > m_stagingCapacity)
+            return false;
+
+        auto event = reinterpret_cast<Trace::Event*>(m_staging.get() + m_stagingSize);
+        event->samplePosition = metaData.samplePosition;
+        event->size = (uint32)metaData.numBytes;
+        memcpy(event + 1, metaData.data, (size_t)metaData.numBytes);
+        m_stagingSize += eventSize;
+        ++numEvents;
+    }
+
+    numBytes = (uint32)(m_stagingSize - start);
+    return true;
+}
+
+void TraceRecorder::dropBlock()
+{
+    ++m_dropped;
+    m_staged = false;
+    m_busy = false;
+}
+
+void TraceRecorder::run()
+{
+    static const uint32_t polling_interval = 2;
+
+    for (;;) {
+        // sample the quit flag first, so the final pass drains everything pushed before stop()
+        const bool quit = m_quit.load();
+
+        // after a failed write the ring is still drained, so the audio thread never sees it full, but nothing more is
+        // written (readers stop at the truncated record)
+        int start1, size1, start2, size2;
+        m_fifo->prepareToRead(m_fifo->getNumReady(), start1, size1, start2, size2);
+        if (!m_failed && size1 > 0 && !writeToFile(m_ring.get() + start1, (size_t)size1))
+            m_failed = true;
+        if (!m_failed && size2 > 0 && !writeToFile(m_ring.get() + start2, (size_t)size2))
+            m_failed = true;
+        m_fifo->finishedRead(size1 + size2);
+
+        if (quit)
+            break;
+
+        if (size1 + size2 == 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(polling_interval));
+    }
+}
+
+bool TraceRecorder::writeToFile(const void* data, size_t size)
+{
+    auto bytes = static_cast<const char*>(data);
+
+    while (size > 0) {
+        // grow the file and map the next chunk once the current one is full
+        if (m_map == nullptr || m_written >= m_mapOffset + chunkBytes) {
+            m_map.reset();
+            m_mapOffset = (m_written / chunkBytes) * chunkBytes;
+            {
+                FileOutputStream stream(m_file);
+                if (stream.failedToOpen() || !stream.setPosition(m_mapOffset + chunkBytes - 1) || !stream.writeByte(0))
+                    return false;
+            }
+            m_map = std::make_unique<MemoryMappedFile>(m_file, Range<int64>(m_mapOffset, m_mapOffset + chunkBytes), MemoryMappedFile::readWrite);
+            if (m_map->getData() == nullptr) {
+                m_map.reset();
+                return false;
+            }
+        }
+
+        const int64 offset = m_written - m_mapOffset;
+        const size_t count = (size_t)jmin((int64)size, chunkBytes - offset);
+        memcpy(static_cast<char*>(m_map->getData()) + offset, bytes, count);
+        m_written += (int64)count;
+        bytes += count;
+        size -= count;
+    }
+
+    return true;
+}
+
+void TraceRecorder::closeFile()
+{
+    m_map.reset();
+
+    // trim the unused remainder of the last chunk
+    FileOutputStream stream(m_file);
+    if (stream.openedOk() && stream.setPosition(m_written))
+        stream.truncate();
+}
@@ -0,0 +1,123 @@
+//
+// File: TraceRecorder.h
+// Desc: Declarations for TraceRecorder class
+//
+
+#ifndef TRACE_RECORDER_H
+#define TRACE_RECORDER_H
+
+#include "apu_trace.h"
+
+#include <atomic>
+#include <thread>
+#include <type_traits>
+
+//
+// TraceRecorder
+//
+// Records every processed block (midi events, buffer size, transport and optionally audio) to a trace file.
+// The audio thread stages each block and pushes it into a lock-free ring buffer, which a writer thread drains
+// into the memory-mapped file. Blocks which don't fit are dropped and counted rather than waiting.
+//
+
+class TraceRecorder
+{
+public:
+    TraceRecorder() {}
+    ~TraceRecorder();
+
+    // start recording to the given file
+    bool start(const File& file, const String& name, double sampleRate, int maxBlockSize, int numChannels, bool recordAudio);
+    // start recording into the directory named by APU_TRACE_DIR, if set (APU_TRACE_AUDIO=1 also records audio)
+    bool startFromEnvironment(const String& name, double sampleRate, int maxBlockSize, int numChannels);
+    void stop();
+
+    bool isRecording() const { return m_recording; }
+    int getDroppedBlocks() const { return m_dropped; }
+    // true once writing to the file failed (e.g. the disk is full), later blocks are dropped
+    bool hasFailed() const { return m_failed; }
+
+    // audio thread interface, a block's input is recorded before it's processed, and its output afterwards
+    template <typename SampleType>
+    void recordInput(const AudioBuffer<SampleType>& buffer, const MidiBuffer& midiMessages, AudioPlayHead* playHead);
+    void recordOutput(const MidiBuffer& midiMessages);
+
+private:
+    Trace::BlockHeader& getStagedHeader() { return *reinterpret_cast<Trace::BlockHeader*>(m_staging.get()); }
+    bool beginBlock(int numSamples, AudioPlayHead* playHead);
+    bool stageEvents(const MidiBuffer& midiMessages, uint32& numEvents, uint32& numBytes);
+    void dropBlock();
+
+    // writer thread
+    void run();
+    bool writeToFile(const void* data, size_t size);
+    void closeFile();
+
+    // recording state, busy is held by the audio thread between recordInput and recordOutput
+    std::atomic<bool> m_recording{ false };
+    std::atomic<bool> m_busy{ false };
+    std::atomic<int> m_dropped{ 0 };
+    std::atomic<bool> m_failed{ false };
+
+    // staged block record (audio thread only)
+    HeapBlock<char> m_staging;
+    size_t m_stagingCapacity = 0;
+    size_t m_stagingSize = 0;
+    bool m_staged = false;
+    bool m_recordAudio = false;
+    uint64 m_index = 0;
+
+    // ring buffer from the audio thread to the writer thread
+    HeapBlock<char> m_ring;
+    std::unique_ptr<AbstractFifo> m_fifo;
+
+    // writer thread resources
+    std::thread m_writer;
+    std::atomic<bool> m_quit{ false };
+    File m_file;
+    std::unique_ptr<MemoryMappedFile> m_map;
+    int64 m_mapOffset = 0;
+    int64 m_written = 0;
+
+    JUCE_DECLARE_NON_COPYABLE(TraceRecorder)
+};
+
+template <typename SampleType>
+void TraceRecorder::recordInput(const AudioBuffer<SampleType>& buffer, const MidiBuffer& midiMessages, AudioPlayHead* playHead)
+{
+    if (!beginBlock(buffer.getNumSamples(), playHead))
+        return;
+
+    auto& header = getStagedHeader();
+    if (!stageEvents(midiMessages, header.numInputEvents, header.inputEventBytes)) {
+        dropBlock();
+        return;
+    }
+
+    // audio is always stored as float32
+    if (m_recordAudio) {
+        const auto numSamples = (size_t)buffer.getNumSamples();
+        const auto audioBytes = (size_t)buffer.getNumChannels() * numSamples * sizeof(float);
+        if (m_stagingSize + audioBytes > m_stagingCapacity) {
+            dropBlock();
+            return;
+        }
+        for (auto i = 0; i < buffer.getNumChannels(); ++i) {
+            auto dest = reinterpret_cast<float*>(m_staging.get() + m_stagingSize);
+            auto source = buffer.getReadPointer(i);
+            if constexpr (std::is_same_v<SampleType, float>) {
+                memcpy(dest, source, numSamples * sizeof(float));
+            }
+            else {
+                for (size_t j = 0; j < numSamples; ++j)
+                    dest[j] = (float)source[j];
+            }
+            m_stagingSize += numSamples * sizeof(float);
+        }
+        header.numChannels = (uint32)buffer.getNumChannels();
+    }
+
+    m_staged = true;
+}
+
+#endif /* TRACE_RECORDER_H */
@@ -0,0 +1,9 @@
+//
+// File: apu_trace.cpp
+// Desc: Pulls in compilation units for this module
+//
+
+#include "apu_trace.h"
+
+#include "TraceRecorder.cpp"
+#include "TraceReader.cpp"
@@ -0,0 +1,30 @@
+/*******************************************************************************
+
+ BEGIN_JUCE_MODULE_DECLARATION
+
+  ID:                 apu_trace
+  vendor:             caustik
+  version:            0.0.1
+  name:               Trace module
+  description:        Records processBlock inputs/outputs to trace files, and reads them back for replay
+  website:            http://www.caustik.com/
+  license:            Commercial
+
+  dependencies:       juce_audio_processors
+
+ END_JUCE_MODULE_DECLARATION
+
+*******************************************************************************/
+
+#ifndef APU_TRACE_H
+#define APU_TRACE_H
+
+#include <JuceHeader.h>
+#include <juce_audio_processors/juce_audio_processors.h>
+using namespace juce;
+
+#include "TraceFormat.h"
+#include "TraceRecorder.h"
+#include "TraceReader.h"
+
+#endif /* APU_TRACE_H */
@@ -9,8 +9,6 @@
 #include <windows.h>
 #endif
 
-static const int controlChangeCount = 128;
-
 DeltaAudioProcessor::DeltaAudioProcessor() : m_vts(*this, &m_undoManager)
 {
 #if defined(WIN32) && defined(_DEBUG)
@@ -22,55 +20,80 @@ DeltaAudioProcessor::DeltaAudioProcessor() : m_vts(*this, &m_undoManager)
     }
 #endif
 
-    // control change parameters
-    m_controlChange.resize(controlChangeCount);
+    m_program.fill(-1);
 
     m_vts.state = ValueTree(Identifier(JucePlugin_Name));
 }
 
 DeltaAudioProcessor::~DeltaAudioProcessor() {}
 
+void DeltaAudioProcessor::prepareToPlay(double sampleRate, int samplesPerBlock)
+{
+    // optionally trace processed blocks
+    const auto numBusChannels = std::max(getTotalNumInputChannels(), getTotalNumOutputChannels());
+    m_trace.startFromEnvironment(getName(), sampleRate, samplesPerBlock, numBusChannels);
+}
+
 void DeltaAudioProcessor::processBlock(AudioBuffer<float>& buffer, MidiBuffer& midiMessages)
 {
     ScopedNoDenormals noDenormals;
 
+    m_trace.recordInput(buffer, midiMessages, getPlayHead());
+
     // clean audio output
     buffer.clear();
 
-    // prepare midi input
-    MidiBuffer processedMidi;
-    for (auto metaData : midiMessages) {
-        const MidiMessage message = metaData.getMessage();
-        const juce::uint8* messageData = message.getRawData();
-
-        // add control changes to pending
-        if (message.isController()) {
-            const juce::uint8 cc = messageData[1];
-            const juce::uint8 value = messageData[2];
-            m_pending.insert(cc);
-            m_controlChange[cc] = value;
-        }
-        // flush pending on program change
-        else if (message.isProgramChange()) {
-            m_pending.clear();
+    // track control and program changes per channel, all MIDI events pass through in place
+    for (const auto metaData : midiMessages) {
+        const juce::uint8* messageData = metaData.data;
+        if (metaData.numBytes < 2)
+            continue;
+
+        const int channel = messageData[0] & 0x0f;
+        switch (messageData[0] & 0xf0) {
+            // add control changes to pending
+            case 0xb0:
+                if (metaData.numBytes >= 3) {
+                    m_controlChange[(size_t)(channel * numControllers + messageData[1])] = messageData[2];
+                    m_pending[(size_t)channel].set(messageData[1]);
+                    m_pendingChannels |= 1u << channel;
+                }
+                break;
+            // flush the channel's pending on program change
+            case 0xc0:
+                m_program[(size_t)channel] = messageData[1];
+                m_pending[(size_t)channel].reset();
+                m_pendingChannels &= ~(1u << channel);
+                break;
+            default:
+                break;
         }
-
-        // pass through all MIDI events
-        processedMidi.addEvent(message, midiMessages.getLastEventTime());
     }
 
     // send any pending outputs at the start of playback
     AudioPlayHead::CurrentPositionInfo position;
     AudioPlayHead* audioPlayHead = getPlayHead();
-    if (playHead && audioPlayHead->getCurrentPosition(position) && position.isPlaying && position.timeInSamples == 0) {
-        for (int idx : m_pending) {
-            MidiMessage message = MidiMessage::controllerEvent(1, idx, m_controlChange[idx]);
-            processedMidi.addEvent(message, (int)midiMessages.getLastEventTime());
-        }
-    }
+    if (audioPlayHead && audioPlayHead->getCurrentPosition(position) && position.isPlaying && position.timeInSamples == 0)
+        recall(midiMessages, midiMessages.getLastEventTime());
+
+    m_trace.recordOutput(midiMessages);
+}
 
-    // replace MIDI output to our modified MIDI
-    midiMessages.swapWith(processedMidi);
+void DeltaAudioProcessor::recall(MidiBuffer& midiMessages, int samplePosition)
+{
+    for (auto channel = 0; channel < numChannels; ++channel) {
+        if ((m_pendingChannels & (1u << channel)) == 0)
+            continue;
+
+        // restore the program first, the changes are relative to it
+        if (m_program[(size_t)channel] >= 0)
+            midiMessages.addEvent(MidiMessage::programChange(channel + 1, m_program[(size_t)channel]), samplePosition);
+
+        const auto& pending = m_pending[(size_t)channel];
+        for (auto cc = 0; cc < numControllers; ++cc)
+            if (pending[(size_t)cc])
+                midiMessages.addEvent(MidiMessage::controllerEvent(channel + 1, cc, m_controlChange[(size_t)(channel * numControllers + cc)]), samplePosition);
+    }
 }
 
 void DeltaAudioProcessor::getStateInformation(MemoryBlock& destData)
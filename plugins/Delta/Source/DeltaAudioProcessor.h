@@ -8,8 +8,8 @@
 
 #include <JuceHeader.h>
 
-#include <vector>
-#include <set>
+#include <array>
+#include <bitset>
 
 //
 // DeltaAudioProcessor
@@ -27,8 +27,8 @@ public:
     const String getName() const override { return JucePlugin_Name; }
 
     // AudioProcessor interface implementation (playback)
-    void prepareToPlay(double sampleRate, int samplesPerBlock) override {}
-    void releaseResources() override {}
+    void prepareToPlay(double sampleRate, int samplesPerBlock) override;
+    void releaseResources() override { m_trace.stop(); }
     void processBlock(AudioBuffer<float>&, MidiBuffer&) override;
 
     // AudioProcessor interface implementation (midi, general)
@@ -57,10 +57,22 @@ private:
     juce::AudioProcessorValueTreeState m_vts;
     juce::UndoManager m_undoManager;
 
-    // control change values
-    std::vector<int> m_controlChange;
-    // pending output parameters
-    std::set<int> m_pending;
+    // trace recording resources
+    TraceRecorder m_trace;
+
+    static constexpr int numChannels = 16;
+    static constexpr int numControllers = 128;
+
+    // recall the pending controllers of every channel, after its program if one was seen
+    void recall(MidiBuffer& midiMessages, int samplePosition);
+
+    // control change values, indexed by channel * numControllers + controller
+    std::array<juce::uint8, numChannels * numControllers> m_controlChange{};
+    // controllers changed since each channel's last program change, and channels with any pending
+    std::array<std::bitset<numControllers>, numChannels> m_pending;
+    uint32 m_pendingChannels = 0;
+    // last program per channel (-1 = none seen)
+    std::array<int, numChannels> m_program;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(DeltaAudioProcessor)
 };
@@ -0,0 +1,658 @@
+//
+// File: Main.cpp
+// Desc: Command line tool for running Python scripts without a host
+//
+
+#include <JuceHeader.h>
+
+#include <new>
+#include <cstdlib>
+
+//
+// Allocation counting
+//
+// Global operator new, Python's allocators for all three domains (raw, mem and object, the latter two are served
+// from pymalloc's pools) and pymalloc's arena allocator are wrapped so that requests for memory made by a thread can
+// be counted. Only objects reused from Python's free lists aren't counted. JUCE containers call malloc directly,
+// MidiBuffers are kept allocation free by reserving them up front instead.
+//
+
+static thread_local bool g_countAllocations = false;
+static int64 g_allocations = 0;
+
+void* operator new(std::size_t size)
+{
+    if (g_countAllocations)
+        ++g_allocations;
+    if (auto ptr = std::malloc(size == 0 ? 1 : size))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) { return operator new(size); }
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { std::free(ptr); }
+
+// original allocators per domain (raw, mem, object), each hook's context points at the one it wraps
+static PyMemAllocatorEx g_allocators[3];
+static PyObjectArenaAllocator g_arenaAllocator;
+
+static void* countingMalloc(void* ctx, size_t size)
+{
+    if (g_countAllocations)
+        ++g_allocations;
+    auto allocator = static_cast<PyMemAllocatorEx*>(ctx);
+    return allocator->malloc(allocator->ctx, size);
+}
+
+static void* countingCalloc(void* ctx, size_t count, size_t size)
+{
+    if (g_countAllocations)
+        ++g_allocations;
+    auto allocator = static_cast<PyMemAllocatorEx*>(ctx);
+    return allocator->calloc(allocator->ctx, count, size);
+}
+
+static void* countingRealloc(void* ctx, void* ptr, size_t size)
+{
+    if (g_countAllocations)
+        ++g_allocations;
+    auto allocator = static_cast<PyMemAllocatorEx*>(ctx);
+    return allocator->realloc(allocator->ctx, ptr, size);
+}
+
+static void countingFree(void* ctx, void* ptr)
+{
+    auto allocator = static_cast<PyMemAllocatorEx*>(ctx);
+    allocator->free(allocator->ctx, ptr);
+}
+
+static void* countingArenaAlloc(void* ctx, size_t size)
+{
+    if (g_countAllocations)
+        ++g_allocations;
+    return g_arenaAllocator.alloc(g_arenaAllocator.ctx, size);
+}
+
+static void countingArenaFree(void* ctx, void* ptr, size_t size) { g_arenaAllocator.free(g_arenaAllocator.ctx, ptr, size); }
+
+// hook Python's allocators, call once the interpreter exists (the hooks forward to the original allocators, so memory
+// allocated before they were installed is freed correctly)
+static void installPythonAllocationCounters()
+{
+    const PyMemAllocatorDomain domains[] = { PYMEM_DOMAIN_RAW, PYMEM_DOMAIN_MEM, PYMEM_DOMAIN_OBJ };
+    for (size_t i = 0; i < 3; ++i) {
+        PyMem_GetAllocator(domains[i], &g_allocators[i]);
+        PyMemAllocatorEx allocator = { &g_allocators[i], countingMalloc, countingCalloc, countingRealloc, countingFree };
+        PyMem_SetAllocator(domains[i], &allocator);
+    }
+
+    PyObject_GetArenaAllocator(&g_arenaAllocator);
+    PyObjectArenaAllocator arena = { nullptr, countingArenaAlloc, countingArenaFree };
+    PyObject_SetArenaAllocator(&arena);
+}
+
+//
+// HeadlessProcessor
+//
+// PythonAudioProcessor driven directly by the tool, acting as its own play head
+//
+
+class HeadlessProcessor : public PythonAudioProcessor, public AudioPlayHead
+{
+public:
+    HeadlessProcessor()
+    {
+        AudioProcessor::setPlayHead(this);
+        // scripts run as fast as possible, so the realtime callback budget doesn't apply
+        AudioProcessor::setNonRealtime(true);
+    }
+
+    bool load(const File& script)
+    {
+        if (!script.existsAsFile())
+            return false;
+
+        const String content = script.loadFileAsString();
+        execute(script.getFullPathName().toRawUTF8(), content.toRawUTF8());
+        return true;
+    }
+
+    void prepare(double sampleRate, int maxBlockSize)
+    {
+        AudioProcessor::setRateAndBufferSizeDetails(sampleRate, maxBlockSize);
+        prepareToPlay(sampleRate, maxBlockSize);
+    }
+
+    void setPosition(const CurrentPositionInfo* position)
+    {
+        m_hasPosition = position != nullptr;
+        if (m_hasPosition)
+            m_position = *position;
+    }
+
+    // AudioPlayHead interface implementation
+    bool getCurrentPosition(CurrentPositionInfo& result) override
+    {
+        if (m_hasPosition)
+            result = m_position;
+        return m_hasPosition;
+    }
+
+private:
+    CurrentPositionInfo m_position;
+    bool m_hasPosition = false;
+
+    JUCE_DECLARE_NON_COPYABLE(HeadlessProcessor)
+};
+
+static bool isEqual(const MidiBuffer& a, const MidiBuffer& b)
+{
+    auto i = a.begin();
+    auto j = b.begin();
+    for (; i != a.end() && j != b.end(); ++i, ++j) {
+        const auto x = *i;
+        const auto y = *j;
+        if (x.samplePosition != y.samplePosition || x.numBytes != y.numBytes || memcmp(x.data, y.data, (size_t)x.numBytes) != 0)
+            return false;
+    }
+    return i == a.end() && j == b.end();
+}
+
+//
+// replay <trace> <script> [<script>]
+//
+// Feeds a recorded trace through a script as fast as possible, reporting timing and any differences between the
+// script's midi output and the recorded output. With a second script, the two are compared against each other.
+//
+
+static int replay(const StringArray& args)
+{
+    TraceReader reader;
+    if (!reader.open(File::getCurrentWorkingDirectory().getChildFile(args[1]))) {
+        printf("unable to open trace '%s'\n", args[1].toRawUTF8());
+        return 1;
+    }
+
+    // load the script(s)
+    const auto& header = reader.getHeader();
+    OwnedArray<HeadlessProcessor> processors;
+    for (auto i = 2; i < args.size(); ++i) {
+        auto processor = processors.add(new HeadlessProcessor());
+        if (!processor->load(File::getCurrentWorkingDirectory().getChildFile(args[i]))) {
+            printf("unable to load script '%s'\n", args[i].toRawUTF8());
+            return 1;
+        }
+        processor->prepare(header.sampleRate, header.maxBlockSize);
+    }
+
+    // per-script processing resources and statistics
+    struct Run
+    {
+        AudioBuffer<float> buffer;
+        MidiBuffer midiMessages;
+        double totalMs = 0.0;
+        double maxMs = 0.0;
+        int midiDifferences = 0;
+    };
+    std::vector<Run> runs((size_t)processors.size());
+
+    MidiBuffer input, recorded;
+    int64 numBlocks = 0;
+    int64 numSamples = 0;
+    int64 numEvents = 0;
+    int abMidiDifferences = 0;
+    float abMaxAudioDifference = 0.0f;
+
+    TraceReader::Block block;
+    while (reader.readNextBlock(block)) {
+        const auto& blockHeader = *block.header;
+        const int blockSamples = (int)blockHeader.numSamples;
+
+        AudioPlayHead::CurrentPositionInfo position;
+        const bool hasPosition = TraceReader::getPosition(blockHeader, position);
+
+        input.clear();
+        recorded.clear();
+        if (!TraceReader::getEvents(block.inputEvents, blockHeader.numInputEvents, blockHeader.inputEventBytes, input)
+            || !TraceReader::getEvents(block.outputEvents, blockHeader.numOutputEvents, blockHeader.outputEventBytes, recorded)) {
+            printf("block %lld has corrupt events, replay stops here\n", (long long)blockHeader.index);
+            break;
+        }
+
+        for (auto i = 0; i < processors.size(); ++i) {
+            auto& processor = *processors[i];
+            auto& run = runs[(size_t)i];
+
+            // recreate the block's input
+            const auto numChannels = std::max(processor.getTotalNumInputChannels(), processor.getTotalNumOutputChannels());
+            run.buffer.setSize(numChannels, blockSamples, false, false, true);
+            for (auto channel = 0; channel < numChannels; ++channel) {
+                if (block.audio != nullptr && channel < (int)blockHeader.numChannels)
+                    run.buffer.copyFrom(channel, 0, block.audio + (size_t)channel * blockSamples, blockSamples);
+                else
+                    run.buffer.clear(channel, 0, blockSamples);
+            }
+            run.midiMessages.clear();
+            run.midiMessages.addEvents(input, 0, -1, 0);
+            processor.setPosition(hasPosition ? &position : nullptr);
+
+            const double start = Time::getMillisecondCounterHiRes();
+            processor.processBlock(run.buffer, run.midiMessages);
+            const double elapsed = Time::getMillisecondCounterHiRes() - start;
+
+            run.totalMs += elapsed;
+            run.maxMs = std::max(run.maxMs, elapsed);
+            run.midiDifferences += isEqual(run.midiMessages, recorded) ? 0 : 1;
+        }
+
+        // compare the first two scripts against each other
+        if (runs.size() > 1) {
+            abMidiDifferences += isEqual(runs[0].midiMessages, runs[1].midiMessages) ? 0 : 1;
+            const auto numChannels = std::min(runs[0].buffer.getNumChannels(), runs[1].buffer.getNumChannels());
+            for (auto channel = 0; channel < numChannels; ++channel) {
+                auto a = runs[0].buffer.getReadPointer(channel);
+                auto b = runs[1].buffer.getReadPointer(channel);
+                for (auto j = 0; j < blockSamples; ++j)
+                    abMaxAudioDifference = std::max(abMaxAudioDifference, std::abs(a[j] - b[j]));
+            }
+        }
+
+        ++numBlocks;
+        numSamples += blockSamples;
+        numEvents += blockHeader.numInputEvents;
+    }
+
+    // report
+    const double audioMs = header.sampleRate > 0.0 ? 1000.0 * (double)numSamples / header.sampleRate : 0.0;
+    printf("trace: %s, %lld blocks, %lld events, %.1f ms of audio at %.0f Hz\n", header.name, (long long)numBlocks, (long long)numEvents, audioMs,
+        header.sampleRate);
+    for (auto i = 0; i < processors.size(); ++i) {
+        const auto& run = runs[(size_t)i];
+        printf("script %c: %s\n", 'A' + i, args[i + 2].toRawUTF8());
+        printf("  total %.3f ms, mean %.3f us/block, max %.3f us/block, %.1fx realtime\n", run.totalMs,
+            numBlocks > 0 ? 1000.0 * run.totalMs / (double)numBlocks : 0.0, 1000.0 * run.maxMs, run.totalMs > 0.0 ? audioMs / run.totalMs : 0.0);
+        printf("  %d blocks with midi output differing from the trace\n", run.midiDifferences);
+    }
+    if (runs.size() > 1)
+        printf("A/B: %d blocks with differing midi output, max audio difference %g\n", abMidiDifferences, abMaxAudioDifference);
+
+    return 0;
+}
+
+//
+// alloc [<script>]
+//
+// Feeds generated audio and midi through a script and fails if processBlock allocates any heap memory once warmed
+// up. Without a script, a built-in script with trivial processing functions is used, so any allocation counted is
+// made by the plugin itself. Its input includes values beyond Python's small int cache (pitch bend, a 14-bit
+// controller, NRPN/RPN data entry) and it declares parameters.
+//
+
+static const char* allocScript = R"(
+cc14_inputs = [1]
+
+def getMidiOutputs():
+    return [(b'\xb0\x10', b''), (b'\x90\x3c', b'')]
+
+def getParameters():
+    return [('gain', 0.0, 1.0, 0.5), ('tone', 0.0, 1.0, 0.25)]
+
+def processAudio(inputs, outputs):
+    gain = params['gain']
+
+def processMidiControls(inputs, outputs):
+    outputs[0] = 64
+
+def processMidiNotes(inputs, on, outputs):
+    outputs[1] = 100
+
+def processProgramChanges(inputs, outputs):
+    pass
+
+def processPitchBend(inputs, outputs):
+    pass
+
+def processMidiParameters(inputs, outputs):
+    pass
+)";
+
+static int alloc(const StringArray& args)
+{
+    const double sampleRate = 48000.0;
+    const int blockSize = 256;
+    const int numWarmupBlocks = 64;
+    const int numBlocks = 4096;
+
+    // allocations are counted on the calling thread, so scripts must run there rather than on scheduler workers
+    PythonScheduler::disable();
+
+    // the realtime path is the one being certified: exclusive lock, watchdog and callback budget
+    HeadlessProcessor processor;
+    processor.setNonRealtime(false);
+    if (args.size() > 1) {
+        if (!processor.load(File::getCurrentWorkingDirectory().getChildFile(args[1]))) {
+            printf("unable to load script '%s'\n", args[1].toRawUTF8());
+            return 1;
+        }
+    }
+    else {
+        processor.execute(File::getCurrentWorkingDirectory().getChildFile("alloc.py").getFullPathName().toRawUTF8(), allocScript);
+    }
+    processor.prepare(sampleRate, blockSize);
+    installPythonAllocationCounters();
+
+    const auto numChannels = std::max(processor.getTotalNumInputChannels(), processor.getTotalNumOutputChannels());
+    AudioBuffer<float> buffer(numChannels, blockSize);
+    MidiBuffer midiMessages;
+    midiMessages.ensureSize(4096);
+
+    int64 allocations = 0;
+    int blocksWithAllocations = 0;
+    for (auto block = 0; block < numWarmupBlocks + numBlocks; ++block) {
+        // a little of everything each block, notes, controllers, a program change and some audio
+        buffer.clear();
+        for (auto channel = 0; channel < numChannels; ++channel)
+            for (auto i = 0; i < blockSize; ++i)
+                buffer.setSample(channel, i, 0.25f * std::sin(0.01f * (float)(block * blockSize + i)));
+        midiMessages.clear();
+        const auto note = 36 + block % 48;
+        midiMessages.addEvent(MidiMessage::noteOn(1, note, (uint8)100), 0);
+        midiMessages.addEvent(MidiMessage::controllerEvent(1, 1 + block % 8, block % 128), 16);
+        midiMessages.addEvent(MidiMessage::noteOff(1, note, (uint8)0), 128);
+        if (block % 16 == 0)
+            midiMessages.addEvent(MidiMessage::programChange(1, block % 128), 200);
+
+        // values above Python's small int cache: pitch bend, a 14-bit controller and NRPN/RPN data entry
+        const auto value14 = (block * 37) % 16384;
+        midiMessages.addEvent(MidiMessage::pitchWheel(1, value14), 32);
+        midiMessages.addEvent(MidiMessage::controllerEvent(1, 1, value14 >> 7), 48);
+        midiMessages.addEvent(MidiMessage::controllerEvent(1, 33, value14 & 0x7f), 49);
+        midiMessages.addEvent(MidiMessage::controllerEvent(1, block % 2 == 0 ? 99 : 101, 1 + block % 64), 64);
+        midiMessages.addEvent(MidiMessage::controllerEvent(1, block % 2 == 0 ? 98 : 100, block % 128), 65);
+        midiMessages.addEvent(MidiMessage::controllerEvent(1, 6, value14 >> 7), 66);
+        midiMessages.addEvent(MidiMessage::controllerEvent(1, 38, value14 & 0x7f), 67);
+
+        const bool counting = block >= numWarmupBlocks;
+        const int64 before = g_allocations;
+        g_countAllocations = counting;
+        processor.processBlock(buffer, midiMessages);
+        g_countAllocations = false;
+
+        const int64 count = g_allocations - before;
+        allocations += count;
+        blocksWithAllocations += count > 0 ? 1 : 0;
+    }
+
+    printf("%d blocks after %d warm-up blocks: %lld allocations in %d blocks\n", numBlocks, numWarmupBlocks, (long long)allocations,
+        blocksWithAllocations);
+    return allocations == 0 ? 0 : 1;
+}
+
+//
+// midi <script> <file or directory> [<output>]
+//
+// Streams standard midi files through a script block by block, as fast as possible, writing the transformed files
+// and reporting throughput. Tracks are processed one after another, and meta events (tempo, names, ...) bypass
+// the script since a host never delivers them. Outputs default to <name>.out.mid next to each input.
+//
+
+// conversion between a file's ticks and seconds using its tempo map
+class TempoMap
+{
+public:
+    TempoMap(const MidiFile& file)
+    {
+        const auto timeFormat = file.getTimeFormat();
+        if (timeFormat > 0) {
+            m_ticksPerQuarter = timeFormat;
+            m_segments.push_back({ 0.0, 0.0, 0.5 / timeFormat });
+
+            // each tempo change starts a new segment
+            MidiMessageSequence tempos;
+            file.findAllTempoEvents(tempos);
+            for (auto i = 0; i < tempos.getNumEvents(); ++i) {
+                const auto& message = tempos.getEventPointer(i)->message;
+                const auto& last = m_segments.back();
+                const double tick = message.getTimeStamp();
+                m_segments.push_back({ tick, last.seconds + (tick - last.tick) * last.secondsPerTick, message.getTempoSecondsPerQuarterNote() / timeFormat });
+            }
+        }
+        else {
+            // smpte, frames per second in the high byte (negated) and ticks per frame in the low byte
+            const int framesPerSecond = -(timeFormat >> 8);
+            const int ticksPerFrame = timeFormat & 0xff;
+            m_segments.push_back({ 0.0, 0.0, 1.0 / jmax(1, framesPerSecond * ticksPerFrame) });
+        }
+    }
+
+    double toSeconds(double tick) const
+    {
+        const auto& segment = find([tick](const Segment& s) { return s.tick <= tick; });
+        return segment.seconds + (tick - segment.tick) * segment.secondsPerTick;
+    }
+
+    double toTicks(double seconds) const
+    {
+        const auto& segment = find([seconds](const Segment& s) { return s.seconds <= seconds; });
+        return segment.tick + (seconds - segment.seconds) / segment.secondsPerTick;
+    }
+
+    // fill in a play head position, smpte files are treated as 120 bpm
+    void getPosition(double seconds, int64 timeInSamples, AudioPlayHead::CurrentPositionInfo& position) const
+    {
+        position.resetToDefault();
+        position.timeInSamples = timeInSamples;
+        position.timeInSeconds = seconds;
+        position.isPlaying = true;
+        if (m_ticksPerQuarter > 0) {
+            const auto& segment = find([seconds](const Segment& s) { return s.seconds <= seconds; });
+            position.bpm = 60.0 / (segment.secondsPerTick * m_ticksPerQuarter);
+            position.ppqPosition = toTicks(seconds) / m_ticksPerQuarter;
+        }
+        else {
+            position.ppqPosition = seconds * position.bpm / 60.0;
+        }
+    }
+
+private:
+    struct Segment
+    {
+        double tick;
+        double seconds;
+        double secondsPerTick;
+    };
+
+    // last segment starting at or before a time
+    template <typename Predicate>
+    const Segment& find(Predicate startsBefore) const
+    {
+        size_t i = 0;
+        while (i + 1 < m_segments.size() && startsBefore(m_segments[i + 1]))
+            ++i;
+        return m_segments[i];
+    }
+
+    int m_ticksPerQuarter = 0;
+    std::vector<Segment> m_segments;
+};
+
+struct MidiRunStats
+{
+    int64 eventsIn = 0;
+    int64 eventsOut = 0;
+    int64 blocks = 0;
+    double totalMs = 0.0;
+};
+
+static bool transformMidiFile(const File& script, const File& input, const File& output, MidiRunStats& stats)
+{
+    const double sampleRate = 48000.0;
+    const int blockSize = 256;
+    // after the last input event, processing continues until the script has been silent this long (e.g. released
+    // notes, delays), or the tail reaches its maximum
+    const int64 tailSilence = (int64)(1.0 * sampleRate);
+    const int64 maxTail = (int64)(30.0 * sampleRate);
+
+    FileInputStream stream(input);
+    MidiFile file;
+    if (!stream.openedOk() || !file.readFrom(stream))
+        return false;
+    const TempoMap tempoMap(file);
+
+    MidiFile result;
+    if (file.getTimeFormat() > 0)
+        result.setTicksPerQuarterNote(file.getTimeFormat());
+    else
+        result.setSmpteTimeFormat(-(file.getTimeFormat() >> 8), file.getTimeFormat() & 0xff);
+
+    MidiBuffer midiMessages;
+    midiMessages.ensureSize(4096);
+    AudioPlayHead::CurrentPositionInfo position;
+
+    for (auto t = 0; t < file.getNumTracks(); ++t) {
+        const auto& track = *file.getTrack(t);
+        MidiMessageSequence transformed;
+
+        // every track starts from the beginning of the song, with a freshly executed script so no state (held notes,
+        // counters, ...) carries over from the previous track
+        HeadlessProcessor processor;
+        if (!processor.load(script))
+            return false;
+        processor.prepare(sampleRate, blockSize);
+
+        const auto numChannels = std::max(processor.getTotalNumInputChannels(), processor.getTotalNumOutputChannels());
+        AudioBuffer<float> buffer(numChannels, blockSize);
+
+        const int numEvents = track.getNumEvents();
+        const int64 endSample = numEvents > 0 ? (int64)(tempoMap.toSeconds(track.getEndTime()) * sampleRate) + 1 : 0;
+        int64 lastOutput = 0;
+        int index = 0;
+        for (int64 blockStart = 0; blockStart < endSample || (blockStart - lastOutput < tailSilence && blockStart < endSample + maxTail);
+             blockStart += blockSize) {
+            // gather the block's input
+            midiMessages.clear();
+            for (; index < numEvents; ++index) {
+                const auto& message = track.getEventPointer(index)->message;
+                const auto sample = (int64)(tempoMap.toSeconds(message.getTimeStamp()) * sampleRate);
+                if (sample >= blockStart + blockSize)
+                    break;
+                if (message.isMetaEvent()) {
+                    // the end of track is written after the tail
+                    if (!message.isEndOfTrackMetaEvent())
+                        transformed.addEvent(message);
+                }
+                else {
+                    midiMessages.addEvent(message, (int)(sample - blockStart));
+                    ++stats.eventsIn;
+                }
+            }
+
+            tempoMap.getPosition((double)blockStart / sampleRate, blockStart, position);
+            processor.setPosition(&position);
+            buffer.clear();
+
+            const double start = Time::getMillisecondCounterHiRes();
+            processor.processBlock(buffer, midiMessages);
+            stats.totalMs += Time::getMillisecondCounterHiRes() - start;
+            ++stats.blocks;
+
+            // back to ticks
+            for (const auto metaData : midiMessages) {
+                const double seconds = (double)(blockStart + metaData.samplePosition) / sampleRate;
+                transformed.addEvent(metaData.getMessage().withTimeStamp(std::round(tempoMap.toTicks(seconds))));
+                ++stats.eventsOut;
+                lastOutput = blockStart + blockSize;
+            }
+        }
+
+        transformed.updateMatchedPairs();
+        result.addTrack(transformed);
+    }
+
+    output.deleteFile();
+    FileOutputStream outputStream(output);
+    return outputStream.openedOk() && result.writeTo(outputStream);
+}
+
+static int midi(const StringArray& args)
+{
+    // the script is executed afresh for every track (see transformMidiFile)
+    const File script = File::getCurrentWorkingDirectory().getChildFile(args[1]);
+    if (!script.existsAsFile()) {
+        printf("unable to load script '%s'\n", args[1].toRawUTF8());
+        return 1;
+    }
+
+    // a single file, or every midi file in a directory (skipping earlier outputs)
+    const File input = File::getCurrentWorkingDirectory().getChildFile(args[2]);
+    const bool directory = input.isDirectory();
+    Array<File> inputs;
+    if (directory) {
+        for (auto& file : input.findChildFiles(File::findFiles, false, "*.mid;*.midi"))
+            if (!file.getFileName().endsWithIgnoreCase(".out.mid"))
+                inputs.add(file);
+        inputs.sort();
+    }
+    else {
+        inputs.add(input);
+    }
+
+    const File outputDirectory = directory && args.size() > 3 ? File::getCurrentWorkingDirectory().getChildFile(args[3]) : File();
+    if (outputDirectory != File())
+        outputDirectory.createDirectory();
+
+    MidiRunStats total;
+    int failures = 0;
+    for (auto& file : inputs) {
+        File output;
+        if (!directory && args.size() > 3)
+            output = File::getCurrentWorkingDirectory().getChildFile(args[3]);
+        else
+            output = (outputDirectory != File() ? outputDirectory : file.getParentDirectory()).getChildFile(file.getFileNameWithoutExtension() + ".out.mid");
+
+        MidiRunStats stats;
+        if (!transformMidiFile(script, file, output, stats)) {
+            printf("%s: unable to transform\n", file.getFileName().toRawUTF8());
+            ++failures;
+            continue;
+        }
+
+        printf("%s: %lld events in, %lld out, %lld blocks, %.3f ms, %.0f events/s\n", file.getFileName().toRawUTF8(), (long long)stats.eventsIn,
+            (long long)stats.eventsOut, (long long)stats.blocks, stats.totalMs, stats.totalMs > 0.0 ? 1000.0 * (double)stats.eventsIn / stats.totalMs : 0.0);
+
+        total.eventsIn += stats.eventsIn;
+        total.eventsOut += stats.eventsOut;
+        total.blocks += stats.blocks;
+        total.totalMs += stats.totalMs;
+    }
+
+    if (inputs.size() > 1)
+        printf("total: %d files, %lld events in, %lld out, %lld blocks, %.3f ms, %.0f events/s\n", inputs.size(), (long long)total.eventsIn,
+            (long long)total.eventsOut, (long long)total.blocks, total.totalMs, total.totalMs > 0.0 ? 1000.0 * (double)total.eventsIn / total.totalMs : 0.0);
+
+    return failures == 0 && !inputs.isEmpty() ? 0 : 1;
+}
+
+int main(int argc, char* argv[])
+{
+    ScopedJuceInitialiser_GUI juce;
+
+    StringArray args;
+    for (auto i = 1; i < argc; ++i)
+        args.add(argv[i]);
+
+    if (args.size() >= 3 && args[0] == "replay")
+        return replay(args);
+    if (args.size() >= 1 && args[0] == "alloc")
+        return alloc(args);
+    if (args.size() >= 3 && args[0] == "midi")
+        return midi(args);
+
+    printf("usage: PyTool replay <trace> <script> [<script>]\n");
+    printf("       PyTool alloc [<script>]\n");
+    printf("       PyTool midi <script> <file or directory> [<output>]\n");
+    return 1;
+}